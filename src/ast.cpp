@@ -2,14 +2,21 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <sstream>
 #include <stdexcept>
 #include <variant>
 #include <cassert>
 #include <vector>
 #include <numeric>
 #include <functional>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
 
 int next_reg = 0, if_stmt_count = 0, lor_stmt_count = 0, land_stmt_count = 0, while_stmt_count = 0;
+std::unordered_set<std::string> readonly_global_names;
+std::unordered_set<std::string> source_identifiers;
 
 struct IRResult {
     std::string value;
@@ -29,6 +36,8 @@ struct SymbolInfo {
     SymbolKind kind;
     std::string type;
     std::vector<int> dimensions;
+    std::vector<int> const_values;
+    int binding_id = 0;
 };
 
 struct SymbolTable {
@@ -80,9 +89,11 @@ public:
             do {
                 int count = symbol_counter[symbol.name]++;
                 candidate_name = symbol.name + "_" + std::to_string(count);
-            } while (global_scope->var_table.count(candidate_name));
+            } while (global_scope->var_table.count(candidate_name) || hoisted_names.count(candidate_name));
+            local_names.insert(candidate_name);
             symbol.unique_name = candidate_name;
         }
+        symbol.binding_id = next_binding_id++;
         current_scope->var_table[symbol.name] = symbol;
         return true;
     }
@@ -130,12 +141,89 @@ public:
         symbol_counter.clear();
     }
 
+    // Constant evaluation records which bindings each result was computed from,
+    // one frame per AST node being evaluated.
+    void begin_const_eval() {
+        const_eval_deps.emplace_back();
+    }
+
+    std::vector<std::pair<std::string, int>> end_const_eval() {
+        auto deps = std::move(const_eval_deps.back());
+        const_eval_deps.pop_back();
+        return deps;
+    }
+
+    void record_const_dependency(const std::string& name, int binding_id) {
+        if (!const_eval_deps.empty()) {
+            const_eval_deps.back().emplace_back(name, binding_id);
+        }
+    }
+
+    bool bindings_unchanged(const std::vector<std::pair<std::string, int>>& deps) {
+        for (const auto& [name, binding_id] : deps) {
+            SymbolInfo* symbol = lookup_symbol(name);
+            if (!symbol || symbol->binding_id != binding_id) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string hoisted_global_name(const std::string& name) {
+        // Checking the whole source, not just the globals seen so far, also
+        // avoids those declared further down. Locals renamed before this one
+        // are avoided here, those renamed after it in add_symbol.
+        std::string candidate_name;
+        do {
+            candidate_name = "__" + name + "_" + std::to_string(hoisted_counter++);
+        } while (source_identifiers.count(candidate_name) || local_names.count(candidate_name));
+        hoisted_names.insert(candidate_name);
+        return candidate_name;
+    }
+
+    void add_hoisted_global(const std::string& definition) {
+        hoisted_globals += definition;
+    }
+
+    std::string take_hoisted_globals() {
+        std::string definitions;
+        definitions.swap(hoisted_globals);
+        return definitions;
+    }
+
 private:
     std::vector<std::unique_ptr<SymbolTable>> table_stack;
     std::unordered_map<std::string, int> symbol_counter;
+    int hoisted_counter = 0;
+    std::unordered_set<std::string> local_names;
+    std::unordered_set<std::string> hoisted_names;
+    std::string hoisted_globals;
+    int next_binding_id = 1;
+    std::vector<std::vector<std::pair<std::string, int>>> const_eval_deps;
     std::vector<LoopContext> loop_stack;
 };
 
+int BaseAST::evaluate_const(SymbolTableManager& symbols) const {
+    if (!const_cache.valid || !symbols.bindings_unchanged(const_cache.deps)) {
+        symbols.begin_const_eval();
+        int value;
+        try {
+            value = compute_const(symbols);
+        } catch (...) {
+            symbols.end_const_eval();
+            throw;
+        }
+        auto deps = symbols.end_const_eval();
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+        const_cache = {true, value, std::move(deps)};
+    }
+    for (const auto& [name, binding_id] : const_cache.deps) {
+        symbols.record_const_dependency(name, binding_id);
+    }
+    return const_cache.value;
+}
+
 std::ostream& operator<<(std::ostream& os, const BaseAST& ast) {
     SymbolTableManager symbols;
     ast.generate_ir(os, symbols);
@@ -200,6 +288,91 @@ void flatten_initializer(
     }
 }
 
+bool parse_literal(const std::string& value, int& out) {
+    if (value.empty() || value[0] == '%' || value[0] == '@') {
+        return false;
+    }
+    out = std::stoi(value);
+    return true;
+}
+
+// Evaluates a Koopa binary operator with the wrap-around semantics of the target.
+bool eval_binary_op(const std::string& op, int lhs, int rhs, int& result) {
+    uint32_t l = static_cast<uint32_t>(lhs), r = static_cast<uint32_t>(rhs);
+    if (op == "add") result = static_cast<int>(l + r);
+    else if (op == "sub") result = static_cast<int>(l - r);
+    else if (op == "mul") result = static_cast<int>(l * r);
+    else if (op == "div" || op == "mod") {
+        if (rhs == 0) return false;
+        if (lhs == std::numeric_limits<int>::min() && rhs == -1) {
+            result = op == "div" ? lhs : 0;
+        } else {
+            result = op == "div" ? lhs / rhs : lhs % rhs;
+        }
+    }
+    else if (op == "lt") result = lhs < rhs;
+    else if (op == "gt") result = lhs > rhs;
+    else if (op == "le") result = lhs <= rhs;
+    else if (op == "ge") result = lhs >= rhs;
+    else if (op == "eq") result = lhs == rhs;
+    else if (op == "ne") result = lhs != rhs;
+    else return false;
+    return true;
+}
+
+// Folds `lhs op rhs` when both operands are literals or an algebraic identity
+// makes the result known without emitting an instruction.
+bool fold_binary(const std::string& op, const std::string& lhs, const std::string& rhs, std::string& result) {
+    int l = 0, r = 0;
+    bool lhs_const = parse_literal(lhs, l);
+    bool rhs_const = parse_literal(rhs, r);
+    if (lhs_const && rhs_const) {
+        int value;
+        if (!eval_binary_op(op, l, r, value)) return false;
+        result = std::to_string(value);
+        return true;
+    }
+    if (op == "add") {
+        if (lhs_const && l == 0) { result = rhs; return true; }
+        if (rhs_const && r == 0) { result = lhs; return true; }
+    } else if (op == "sub") {
+        if (rhs_const && r == 0) { result = lhs; return true; }
+        if (lhs == rhs) { result = "0"; return true; }
+    } else if (op == "mul") {
+        if ((lhs_const && l == 0) || (rhs_const && r == 0)) { result = "0"; return true; }
+        if (lhs_const && l == 1) { result = rhs; return true; }
+        if (rhs_const && r == 1) { result = lhs; return true; }
+    } else if (op == "div") {
+        if (rhs_const && r == 1) { result = lhs; return true; }
+    } else if (op == "mod") {
+        if (rhs_const && (r == 1 || r == -1)) { result = "0"; return true; }
+    } else if (lhs == rhs) {
+        if (op == "eq" || op == "le" || op == "ge") { result = "1"; return true; }
+        if (op == "ne" || op == "lt" || op == "gt") { result = "0"; return true; }
+    }
+    return false;
+}
+
+IRResult emit_binary(std::ostream& os, const std::string& op, const std::string& lhs, const std::string& rhs) {
+    std::string folded;
+    if (fold_binary(op, lhs, rhs, folded)) {
+        return {folded, false};
+    }
+    std::string result_reg = "%" + std::to_string(next_reg++);
+    os << "  " << result_reg << " = " << op << " " << lhs << ", " << rhs << std::endl;
+    return {result_reg, false};
+}
+
+// Emits a conditional branch, or a plain jump when the condition folded to a literal.
+void emit_branch(std::ostream& os, const std::string& cond, const std::string& true_label, const std::string& false_label) {
+    int value;
+    if (parse_literal(cond, value)) {
+        os << "  jump %" << (value ? true_label : false_label) << std::endl;
+    } else {
+        os << "  br " << cond << ", %" << true_label << ", %" << false_label << std::endl;
+    }
+}
+
 IRResult CompUnitAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) const {
     os << R"(decl @getint(): i32
 decl @getch(): i32
@@ -231,7 +404,9 @@ decl @stoptime()
     return {"", true};
 }
 
-IRResult FuncDefAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) const {
+IRResult FuncDefAST::generate_ir(std::ostream& out, SymbolTableManager& symbols) const {
+    // The body is buffered so that globals hoisted out of it can be emitted first.
+    std::ostringstream os;
     next_reg = 0;
     if_stmt_count = 0;
     lor_stmt_count = 0;
@@ -297,6 +472,7 @@ IRResult FuncDefAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
     }
     os << "}" << std::endl << std::endl;
     symbols.exit_scope();
+    out << symbols.take_hoisted_globals() << os.str();
     return {"", true};
 }
 
@@ -350,8 +526,7 @@ IRResult StmtAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
                                 os << "  " << load_reg << " = load " << arr << std::endl;
                                 arr = load_reg;
                             }
-                            std::string running_offset_reg = "%" + std::to_string(next_reg++);
-                            os << "  " << running_offset_reg << " = add 0, 0" << std::endl;
+                            std::string running_offset_reg = "0";
 
                             for (size_t i = 0; i < symbol->dimensions.size(); ++i) {
                                 long long stride = 1;
@@ -359,11 +534,8 @@ IRResult StmtAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
                                     stride *= symbol->dimensions[j];
                                 }
                                 auto index_val = lval_ast->array_index_exps[i]->generate_ir(os, symbols);
-                                std::string term_reg = "%" + std::to_string(next_reg++);
-                                os << "  " << term_reg << " = mul " << index_val.value << ", " << stride << std::endl;
-                                std::string next_offset_reg = "%" + std::to_string(next_reg++);
-                                os << "  " << next_offset_reg << " = add " << running_offset_reg << ", " << term_reg << std::endl;
-                                running_offset_reg = next_offset_reg;
+                                auto term = emit_binary(os, "mul", index_val.value, std::to_string(stride));
+                                running_offset_reg = emit_binary(os, "add", running_offset_reg, term.value).value;
                             }
                             final_offset_reg = running_offset_reg;
                             std::string ptr_reg = "%" + std::to_string(next_reg++);
@@ -388,7 +560,7 @@ IRResult StmtAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
             std::string else_label = "else_" + std::to_string(current_if_id);
             std::string endif_label = "if_end_" + std::to_string(current_if_id);
             auto cond_val = cond_exp->generate_ir(os, symbols);
-            os << "  br " << cond_val.value << ", %" << then_label << ", %" << (else_stmt ? else_label : endif_label) << std::endl;
+            emit_branch(os, cond_val.value, then_label, else_stmt ? else_label : endif_label);
             os << "%" << then_label << ":" << std::endl;
             IRResult if_res = if_stmt->generate_ir(os, symbols);
             if (!if_res.is_terminated) {
@@ -416,7 +588,7 @@ IRResult StmtAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
             os << "  jump %" << entry_label << std::endl;
             os << "%" << entry_label << ":" << std::endl;
             auto cond_val = cond_exp->generate_ir(os, symbols);
-            os << "  br " << cond_val.value << ", %" << body_label << ", %" << endwhile_label << std::endl;
+            emit_branch(os, cond_val.value, body_label, endwhile_label);
             os << "%" << body_label << ":" << std::endl;
             symbols.enter_loop(entry_label, endwhile_label);
             auto body_res = while_stmt->generate_ir(os, symbols);
@@ -458,15 +630,12 @@ IRResult UnaryExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
         return primary_exp->generate_ir(os, symbols);
     } else if (unary_exp) { 
         auto operand = unary_exp->generate_ir(os, symbols);
-        std::string result_reg = "%" + std::to_string(next_reg++);
-        if (unary_op == "+") {
-            os << "  " << result_reg << " = add 0, " << operand.value << std::endl;
-        } else if (unary_op == "-") {
-            os << "  " << result_reg << " = sub 0, " << operand.value << std::endl;
+        if (unary_op == "-") {
+            return emit_binary(os, "sub", "0", operand.value);
         } else if (unary_op == "!") {
-            os << "  " << result_reg << " = eq 0, " << operand.value << std::endl;
+            return emit_binary(os, "eq", "0", operand.value);
         }
-        return {result_reg, false};
+        return {operand.value, false};
     } else {
         std::vector<std::string> param_values;
         for (auto& param : func_r_params) {
@@ -505,13 +674,7 @@ IRResult AddExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
     if (add_exp) {
         auto lhs = add_exp->generate_ir(os, symbols);
         auto rhs = mul_exp->generate_ir(os, symbols);
-        std::string result_reg = "%" + std::to_string(next_reg++);
-        if (add_op == "+") {
-            os << "  " << result_reg << " = add " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (add_op == "-") {
-            os << "  " << result_reg << " = sub " << lhs.value << ", " << rhs.value << std::endl;
-        }
-        return {result_reg, false};
+        return emit_binary(os, add_op == "+" ? "add" : "sub", lhs.value, rhs.value);
     } else {
         return mul_exp->generate_ir(os, symbols);
     }
@@ -521,15 +684,8 @@ IRResult MulExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
     if (mul_exp) {
         auto lhs = mul_exp->generate_ir(os, symbols);
         auto rhs = unary_exp->generate_ir(os, symbols);
-        std::string result_reg = "%" + std::to_string(next_reg++);
-        if (mul_op == "*") {
-            os << "  " << result_reg << " = mul " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (mul_op == "/") {
-            os << "  " << result_reg << " = div " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (mul_op == "%") {
-            os << "  " << result_reg << " = mod " << lhs.value << ", " << rhs.value << std::endl;
-        }
-        return {result_reg, false};
+        std::string op = mul_op == "*" ? "mul" : (mul_op == "/" ? "div" : "mod");
+        return emit_binary(os, op, lhs.value, rhs.value);
     } else {
         return unary_exp->generate_ir(os, symbols);
     }
@@ -537,6 +693,17 @@ IRResult MulExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
 
 IRResult LOrExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) const {
     if (lor_exp) {
+        // A literal left operand decides the result, or makes it just the right operand.
+        int lhs_const;
+        auto lhs_res = lor_exp->generate_ir(os, symbols);
+        if (parse_literal(lhs_res.value, lhs_const)) {
+            if (lhs_const) {
+                return {"1", false};
+            }
+            auto rhs_res = land_exp->generate_ir(os, symbols);
+            return emit_binary(os, "ne", "0", rhs_res.value);
+        }
+
         int current_id = lor_stmt_count++;
         std::string eval_rhs_label = "%lor_eval_rhs_" + std::to_string(current_id);
         std::string end_label = "%lor_end_" + std::to_string(current_id);
@@ -544,7 +711,6 @@ IRResult LOrExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
         std::string result_ptr = "@lor_res_" + std::to_string(current_id);
         os << "  " << result_ptr << " = alloc i32" << std::endl;
 
-        auto lhs_res = lor_exp->generate_ir(os, symbols);
         std::string lhs_bool = "%" + std::to_string(next_reg++);
         os << "  " << lhs_bool << " = ne 0, " << lhs_res.value << std::endl;
         os << "  store " << lhs_bool << ", " << result_ptr << std::endl;
@@ -552,9 +718,8 @@ IRResult LOrExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
 
         os << eval_rhs_label << ":" << std::endl;
         auto rhs_res = land_exp->generate_ir(os, symbols);
-        std::string rhs_bool = "%" + std::to_string(next_reg++);
-        os << "  " << rhs_bool << " = ne 0, " << rhs_res.value << std::endl;
-        os << "  store " << rhs_bool << ", " << result_ptr << std::endl;
+        auto rhs_bool = emit_binary(os, "ne", "0", rhs_res.value);
+        os << "  store " << rhs_bool.value << ", " << result_ptr << std::endl;
         os << "  jump " << end_label << std::endl;
 
         os << end_label << ":" << std::endl;
@@ -570,6 +735,16 @@ IRResult LOrExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
 
 IRResult LAndExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) const {
     if (land_exp) {
+        int lhs_const;
+        auto lhs_res = land_exp->generate_ir(os, symbols);
+        if (parse_literal(lhs_res.value, lhs_const)) {
+            if (!lhs_const) {
+                return {"0", false};
+            }
+            auto rhs_res = eq_exp->generate_ir(os, symbols);
+            return emit_binary(os, "ne", "0", rhs_res.value);
+        }
+
         int current_id = land_stmt_count++;
         std::string eval_rhs_label = "%land_eval_rhs_" + std::to_string(current_id);
         std::string end_label = "%land_end_" + std::to_string(current_id);
@@ -577,7 +752,6 @@ IRResult LAndExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
         std::string result_ptr = "@land_res_" + std::to_string(current_id);
         os << "  " << result_ptr << " = alloc i32" << std::endl;
 
-        auto lhs_res = land_exp->generate_ir(os, symbols);
         std::string lhs_bool = "%" + std::to_string(next_reg++);
         os << "  " << lhs_bool << " = ne 0, " << lhs_res.value << std::endl;
         os << "  store " << lhs_bool << ", " << result_ptr << std::endl;
@@ -585,9 +759,8 @@ IRResult LAndExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
 
         os << eval_rhs_label << ":" << std::endl;
         auto rhs_res = eq_exp->generate_ir(os, symbols);
-        std::string rhs_bool = "%" + std::to_string(next_reg++);
-        os << "  " << rhs_bool << " = ne 0, " << rhs_res.value << std::endl;
-        os << "  store " << rhs_bool << ", " << result_ptr << std::endl;
+        auto rhs_bool = emit_binary(os, "ne", "0", rhs_res.value);
+        os << "  store " << rhs_bool.value << ", " << result_ptr << std::endl;
         os << "  jump " << end_label << std::endl;
 
         os << end_label << ":" << std::endl;
@@ -604,13 +777,7 @@ IRResult EqExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) co
     if (eq_exp) {
         auto lhs = eq_exp->generate_ir(os, symbols);
         auto rhs = rel_exp->generate_ir(os, symbols);
-        std::string result_reg = "%" + std::to_string(next_reg++);
-        if (eq_op == "==") {
-            os << "  " << result_reg << " = eq " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (eq_op == "!=") {
-            os << "  " << result_reg << " = ne " << lhs.value << ", " << rhs.value << std::endl;
-        }
-        return {result_reg, false};
+        return emit_binary(os, eq_op == "==" ? "eq" : "ne", lhs.value, rhs.value);
     } else {
         return rel_exp->generate_ir(os, symbols);
     }
@@ -620,17 +787,12 @@ IRResult RelExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) c
     if (rel_exp) {
         auto lhs = rel_exp->generate_ir(os, symbols);
         auto rhs = add_exp->generate_ir(os, symbols);
-        std::string result_reg = "%" + std::to_string(next_reg++);
-        if (rel_op == "<") {
-            os << "  " << result_reg << " = lt " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (rel_op == ">") {
-            os << "  " << result_reg << " = gt " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (rel_op == "<=") {
-            os << "  " << result_reg << " = le " << lhs.value << ", " << rhs.value << std::endl;
-        } else if (rel_op == ">=") {
-            os << "  " << result_reg << " = ge " << lhs.value << ", " << rhs.value << std::endl;
-        }
-        return {result_reg, false};
+        std::string op;
+        if (rel_op == "<") op = "lt";
+        else if (rel_op == ">") op = "gt";
+        else if (rel_op == "<=") op = "le";
+        else op = "ge";
+        return emit_binary(os, op, lhs.value, rhs.value);
     } else {
         return add_exp->generate_ir(os, symbols);
     }
@@ -662,45 +824,43 @@ IRResult ConstDefAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
             symbol.dimensions.push_back(dim_size);
             total_size *= dim_size;
         }
-        symbols.add_symbol(symbol);
-        
+
+        // Keep the flattened values so constant-index reads fold to literals.
         std::vector<const BaseAST*> flat_inits;
         if (const_init_val) {
             int written_count = 0;
             flatten_initializer(const_init_val.get(), symbol.dimensions, flat_inits, 0, written_count);
         }
+        symbol.const_values.assign(total_size, 0);
+        for (size_t i = 0; i < flat_inits.size() && i < symbol.const_values.size(); ++i) {
+            if (flat_inits[i]) {
+                symbol.const_values[i] = flat_inits[i]->evaluate_const(symbols);
+            }
+        }
+        symbols.add_symbol(symbol);
 
+        // Local const arrays never change, so they become a single read-only
+        // global instead of being rebuilt on every call.
+        std::string global_name = symbol.unique_name;
+        if (!symbols.is_global_scope()) {
+            global_name = symbols.hoisted_global_name(ident);
+            symbols.lookup_symbol(ident)->unique_name = global_name;
+        }
+        readonly_global_names.insert(global_name);
+
+        std::ostringstream global_os;
+        global_os << "global @" << global_name << " = alloc [i32, " << total_size << "]" << ", ";
+        global_os << "{";
+        for (int i = 0; i < total_size; i++) {
+            global_os << symbol.const_values[i];
+            if (i < total_size - 1) global_os << ", ";
+        }
+        global_os << "}";
+        global_os << std::endl << std::endl;
         if (symbols.is_global_scope()) {
-            os << "global @" << symbol.unique_name << " = alloc [i32, " << total_size << "]" << ", ";
-            if (const_init_val) {
-                os << "{";
-                for (int i = 0; i < total_size; i++) {
-                    if (i < flat_inits.size() && flat_inits[i]) {
-                        os << flat_inits[i]->evaluate_const(symbols);
-                    } else {
-                        os << "0";
-                    }
-                    if (i < total_size - 1) os << ", ";
-                }
-                os << "}";
-            } else {
-                os << "zeroinit";
-            }
-            os << std::endl << std::endl;
+            os << global_os.str();
         } else {
-            os << "  @" << symbol.unique_name << " = alloc [i32, " << total_size << "]" << std::endl;
-            if (const_init_val) {
-                for (int i = 0; i < total_size; ++i) {
-                    std::string result_reg = "%" + std::to_string(next_reg++);
-                    os << "  " << result_reg << " = getelemptr @" << symbol.unique_name << ", " << i << std::endl;
-                    if (i < flat_inits.size() && flat_inits[i]) {
-                        auto init_val_exp = flat_inits[i]->generate_ir(os, symbols);
-                        os << "  store " << init_val_exp.value << ", " << result_reg << std::endl;
-                    } else {
-                        os << "  store 0, " << result_reg << std::endl;
-                    }
-                }
-            }
+            symbols.add_hoisted_global(global_os.str());
         }
         return {};
     }
@@ -719,13 +879,25 @@ IRResult ConstExpAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
     return {std::to_string(evaluate_const(symbols)), false};
 }
 
-int LValAST::evaluate_const(SymbolTableManager& symbols) const {
+int LValAST::compute_const(SymbolTableManager& symbols) const {
     auto symbol = symbols.lookup_symbol(ident);
     if (!symbol) {
         throw std::runtime_error("Undefined variable: " + ident);
     }
+    symbols.record_const_dependency(ident, symbol->binding_id);
     if (!array_index_exps.empty()) {
-        throw std::logic_error("Cannot evaluate array element in constant expression");
+        if (!symbol->is_const || array_index_exps.size() != symbol->dimensions.size()) {
+            throw std::logic_error("Cannot evaluate array element in constant expression");
+        }
+        long long offset = 0;
+        for (size_t i = 0; i < array_index_exps.size(); ++i) {
+            int index = array_index_exps[i]->evaluate_const(symbols);
+            if (index < 0 || index >= symbol->dimensions[i]) {
+                throw std::runtime_error("Array index out of bounds for " + ident);
+            }
+            offset = offset * symbol->dimensions[i] + index;
+        }
+        return symbol->const_values.at(offset);
     }
     return symbol->value;
 }
@@ -815,7 +987,7 @@ IRResult InitValAST::generate_ir(std::ostream& os, SymbolTableManager& symbols)
     return {};
 }
 
-int PrimaryExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int PrimaryExpAST::compute_const(SymbolTableManager& symbols) const {
     if (exp) {
         return exp->evaluate_const(symbols);
     } else if (lval) {
@@ -825,7 +997,7 @@ int PrimaryExpAST::evaluate_const(SymbolTableManager& symbols) const {
     }
 }
 
-int UnaryExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int UnaryExpAST::compute_const(SymbolTableManager& symbols) const {
     if (primary_exp) {
         return primary_exp->evaluate_const(symbols);
     } else if (unary_exp) {
@@ -839,7 +1011,7 @@ int UnaryExpAST::evaluate_const(SymbolTableManager& symbols) const {
     return 0;
 }
 
-int AddExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int AddExpAST::compute_const(SymbolTableManager& symbols) const {
     if (add_exp) {
         int lhs = add_exp->evaluate_const(symbols);
         int rhs = mul_exp->evaluate_const(symbols);
@@ -851,7 +1023,7 @@ int AddExpAST::evaluate_const(SymbolTableManager& symbols) const {
     return 0;
 }
 
-int MulExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int MulExpAST::compute_const(SymbolTableManager& symbols) const {
     if (mul_exp) {
         int lhs = mul_exp->evaluate_const(symbols);
         int rhs = unary_exp->evaluate_const(symbols);
@@ -864,7 +1036,7 @@ int MulExpAST::evaluate_const(SymbolTableManager& symbols) const {
     return 0;
 }
 
-int RelExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int RelExpAST::compute_const(SymbolTableManager& symbols) const {
     if (rel_exp) {
         int lhs = rel_exp->evaluate_const(symbols);
         int rhs = add_exp->evaluate_const(symbols);
@@ -878,7 +1050,7 @@ int RelExpAST::evaluate_const(SymbolTableManager& symbols) const {
     return 0;
 }
 
-int EqExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int EqExpAST::compute_const(SymbolTableManager& symbols) const {
     if (eq_exp) {
         int lhs = eq_exp->evaluate_const(symbols);
         int rhs = rel_exp->evaluate_const(symbols);
@@ -890,7 +1062,7 @@ int EqExpAST::evaluate_const(SymbolTableManager& symbols) const {
     return 0;
 }
 
-int LAndExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int LAndExpAST::compute_const(SymbolTableManager& symbols) const {
     if (land_exp) {
         int lhs = land_exp->evaluate_const(symbols);
         int rhs = eq_exp->evaluate_const(symbols);
@@ -900,7 +1072,7 @@ int LAndExpAST::evaluate_const(SymbolTableManager& symbols) const {
     }
 }
 
-int LOrExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int LOrExpAST::compute_const(SymbolTableManager& symbols) const {
     if (lor_exp) {
         int lhs = lor_exp->evaluate_const(symbols);
         int rhs = land_exp->evaluate_const(symbols);
@@ -910,20 +1082,20 @@ int LOrExpAST::evaluate_const(SymbolTableManager& symbols) const {
     }
 }
 
-int ExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int ExpAST::compute_const(SymbolTableManager& symbols) const {
     return lor_exp->evaluate_const(symbols);
 }
 
-int ConstInitValAST::evaluate_const(SymbolTableManager& symbols) const {
+int ConstInitValAST::compute_const(SymbolTableManager& symbols) const {
     if (const_exp) return const_exp->evaluate_const(symbols);
     throw std::logic_error("Cannot evaluate initializer list in constant expression");
 }
 
-int ConstExpAST::evaluate_const(SymbolTableManager& symbols) const {
+int ConstExpAST::compute_const(SymbolTableManager& symbols) const {
     return exp->evaluate_const(symbols);
 }
 
-int InitValAST::evaluate_const(SymbolTableManager& symbols) const {
+int InitValAST::compute_const(SymbolTableManager& symbols) const {
     if(exp) return exp->evaluate_const(symbols);
     throw std::logic_error("Cannot evaluate initializer list in constant expression");
 }
@@ -957,8 +1129,7 @@ IRResult LValAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
             arr = load_reg;
         }
 
-        std::string running_offset_reg = "%" + std::to_string(next_reg++);
-        os << "  " << running_offset_reg << " = add 0, 0" << std::endl;
+        std::string running_offset_reg = "0";
 
         for (size_t i = 0; i < array_index_exps.size(); ++i) {
             long long stride = 1;
@@ -966,18 +1137,15 @@ IRResult LValAST::generate_ir(std::ostream& os, SymbolTableManager& symbols) con
                 stride *= symbol->dimensions[j];
             }
             auto index_val = array_index_exps[i]->generate_ir(os, symbols);
-            
-            std::string term_reg;
-            if (stride > 1) {
-                term_reg = "%" + std::to_string(next_reg++);
-                os << "  " << term_reg << " = mul " << index_val.value << ", " << stride << std::endl;
-            } else {
-                term_reg = index_val.value;
-            }
+            auto term = emit_binary(os, "mul", index_val.value, std::to_string(stride));
+            running_offset_reg = emit_binary(os, "add", running_offset_reg, term.value).value;
+        }
 
-            std::string next_offset_reg = "%" + std::to_string(next_reg++);
-            os << "  " << next_offset_reg << " = add " << running_offset_reg << ", " << term_reg << std::endl;
-            running_offset_reg = next_offset_reg;
+        int offset;
+        if (symbol->is_const && array_index_exps.size() == symbol->dimensions.size()
+            && parse_literal(running_offset_reg, offset)
+            && offset >= 0 && offset < static_cast<int>(symbol->const_values.size())) {
+            return {std::to_string(symbol->const_values[offset]), false};
         }
 
         std::string ptr_reg = "%" + std::to_string(next_reg++);
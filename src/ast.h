@@ -5,8 +5,15 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <unordered_set>
 
 extern int var_count;
+// Globals that are never written after initialization (const arrays, and
+// those the optimizer finds unwritten); the backend places them in .rodata.
+extern std::unordered_set<std::string> readonly_global_names;
+// Every identifier in the source, recorded by the lexer, so that names made
+// up for the IR can avoid those the program declares anywhere.
+extern std::unordered_set<std::string> source_identifiers;
 
 struct IRResult;
 class SymbolTableManager;
@@ -22,15 +29,27 @@ typedef enum {
     RETURN_STMT
 } StmtType;
 
+// Memoized result of evaluate_const. It stays valid while every identifier it
+// read still resolves to the same binding.
+struct ConstCache {
+    bool valid = false;
+    int value = 0;
+    std::vector<std::pair<std::string, int>> deps;
+};
+
 class BaseAST {
 public:
     virtual ~BaseAST() = default;
     virtual IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const = 0;
-    virtual int evaluate_const(SymbolTableManager& symbols) const {
+    int evaluate_const(SymbolTableManager& symbols) const;
+    virtual int compute_const(SymbolTableManager& symbols) const {
         throw std::logic_error("evaluate_const not implemented for this AST node");
     }
     
     friend std::ostream& operator<<(std::ostream& os, const BaseAST& ast);
+
+private:
+    mutable ConstCache const_cache;
 };
 
 class CompUnitAST : public BaseAST {
@@ -90,7 +109,7 @@ public:
     std::unique_ptr<BaseAST> const_exp;
     std::vector<std::unique_ptr<BaseAST>> const_inits;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class VarDeclAST : public BaseAST {
@@ -113,7 +132,7 @@ public:
     std::unique_ptr<BaseAST> exp;
     std::vector<std::unique_ptr<BaseAST>> inits;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class BlockAST : public BaseAST {
@@ -139,14 +158,14 @@ class ExpAST : public BaseAST {
 public:
     std::unique_ptr<BaseAST> lor_exp;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class ConstExpAST : public BaseAST {
 public:
     std::unique_ptr<BaseAST> exp;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class LValAST : public BaseAST {
@@ -154,7 +173,7 @@ public:
     std::string ident;
     std::vector<std::unique_ptr<BaseAST>> array_index_exps;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class PrimaryExpAST : public BaseAST {
@@ -163,7 +182,7 @@ public:
     std::unique_ptr<BaseAST> lval;
     int number;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class UnaryExpAST : public BaseAST {
@@ -174,7 +193,7 @@ public:
     std::string ident;
     std::vector<std::unique_ptr<BaseAST>> func_r_params;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class MulExpAST : public BaseAST {
@@ -183,7 +202,7 @@ public:
     std::unique_ptr<BaseAST> mul_exp;
     std::string mul_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class AddExpAST : public BaseAST {
@@ -192,7 +211,7 @@ public:
     std::unique_ptr<BaseAST> add_exp;
     std::string add_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class RelExpAST : public BaseAST {
@@ -201,7 +220,7 @@ public:
     std::unique_ptr<BaseAST> rel_exp;
     std::string rel_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class EqExpAST : public BaseAST {
@@ -210,7 +229,7 @@ public:
     std::unique_ptr<BaseAST> eq_exp;
     std::string eq_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class LAndExpAST : public BaseAST {
@@ -219,7 +238,7 @@ public:
     std::unique_ptr<BaseAST> land_exp;
     std::string land_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
 
 class LOrExpAST : public BaseAST {
@@ -228,5 +247,5 @@ public:
     std::unique_ptr<BaseAST> lor_exp;
     std::string lor_op;
     IRResult generate_ir(std::ostream& os, SymbolTableManager& symbols) const override;
-    int evaluate_const(SymbolTableManager& symbols) const override;
+    int compute_const(SymbolTableManager& symbols) const override;
 };
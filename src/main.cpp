@@ -1,45 +1,153 @@
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <functional>
 #include "ast.h"
 #include "koopa.h"
+#include "passes.h"
 
 using namespace std;
 
 extern FILE *yyin;
 extern int yyparse(unique_ptr<BaseAST> &ast);
 
-static ofstream ofs;
-static int stack_size;
-static bool is_ra_saved;
-static string current_func_name;
+enum class Reg : uint8_t {
+  zero, ra, sp, gp, tp, t0, t1, t2, s0, s1,
+  a0, a1, a2, a3, a4, a5, a6, a7,
+  s2, s3, s4, s5, s6, s7, s8, s9, s10, s11,
+  t3, t4, t5, t6
+};
+static const char *const kRegNames[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1",
+  "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7",
+  "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11",
+  "t3", "t4", "t5", "t6"
+};
+
+static ostream &operator<<(ostream &os, Reg reg) {
+  return os << kRegNames[static_cast<int>(reg)];
+}
+
+static Reg ArgReg(size_t index) {
+  return static_cast<Reg>(static_cast<int>(Reg::a0) + index);
+}
+
+static bool IsCalleeSaved(Reg reg) {
+  return reg == Reg::s0 || reg == Reg::s1 || (reg >= Reg::s2 && reg <= Reg::s11);
+}
+
+static uint32_t RegBit(Reg reg) {
+  return 1u << static_cast<int>(reg);
+}
+
+// Everything a call may overwrite under the standard calling convention.
+static const uint32_t kCallerSavedRegs = [] {
+  uint32_t regs = 0;
+  for (int reg = 0; reg < 32; ++reg) {
+    auto r = static_cast<Reg>(reg);
+    if (r != Reg::zero && r != Reg::sp && r != Reg::gp && r != Reg::tp && !IsCalleeSaved(r)) regs |= RegBit(r);
+  }
+  return regs;
+}();
+
 enum class ValueType {
   STACK,
-  REGISTER,
-  GLOBAL
+  REGISTER
 };
 struct ValueInfo {
   int offset;
-  std::string reg;
+  Reg reg;
   ValueType type;
 };
-static unordered_map<const void*, ValueInfo> value_info_map;
+
+// Open-addressing map from the values of the current function to dense indices.
+class ValueIndexMap {
+public:
+  void Reset(size_t expected) {
+    size_t capacity = 16;
+    while (capacity < expected * 2) capacity <<= 1;
+    keys.assign(capacity, nullptr);
+    indices.assign(capacity, -1);
+  }
+
+  void Release() {
+    vector<koopa_raw_value_t>().swap(keys);
+    vector<int>().swap(indices);
+  }
+
+  void Insert(koopa_raw_value_t key, int index) {
+    size_t slot = Slot(key);
+    while (keys[slot] && keys[slot] != key) slot = (slot + 1) & (keys.size() - 1);
+    keys[slot] = key;
+    indices[slot] = index;
+  }
+
+  int Find(koopa_raw_value_t key) const {
+    size_t slot = Slot(key);
+    while (keys[slot]) {
+      if (keys[slot] == key) return indices[slot];
+      slot = (slot + 1) & (keys.size() - 1);
+    }
+    return -1;
+  }
+
+private:
+  size_t Slot(koopa_raw_value_t key) const {
+    auto bits = reinterpret_cast<uintptr_t>(key) >> 4;
+    return (bits * 0x9E3779B97F4A7C15ull >> 20) & (keys.size() - 1);
+  }
+
+  vector<koopa_raw_value_t> keys;
+  vector<int> indices;
+};
+
+static ofstream ofs;
+static int stack_size;
+static bool is_ra_saved;
+static bool is_leaf;
+// Registers saved in the frame, ra first; saved_regs[i] lives at stack_size - 4 * (i + 1).
+static vector<Reg> saved_regs;
+// Where saved_regs are saved and restored. A null restore_block means the epilogue.
+static koopa_raw_basic_block_t save_block;
+static koopa_raw_basic_block_t restore_block;
+static koopa_raw_basic_block_t current_bb;
+// The block emitted right after current_bb, which a jump to needs no j.
+static koopa_raw_basic_block_t next_bb;
+static koopa_raw_function_t current_func;
+static string current_func_name;
+// Registers each function emitted so far may overwrite, itself or through its
+// callees. Calls of the others, the runtime library and functions in a cycle
+// of the call graph, may overwrite all of kCallerSavedRegs.
+static unordered_map<koopa_raw_function_t, uint32_t> clobbered_regs;
+// Per-function state, indexed by the dense value numbers in value_index.
+static ValueIndexMap value_index;
+static vector<ValueInfo> value_infos;
 
 static void Visit(const koopa_raw_program_t &program);
 static void Visit(const koopa_raw_slice_t &slice);
 static void Visit(const koopa_raw_function_t &func);
 static void Visit(const koopa_raw_basic_block_t &bb);
 static void Visit(const koopa_raw_value_t &value);
-static void LoadValueToRegister(const koopa_raw_value_t &val, const string &reg);
-static void SaveValueFromRegister(const koopa_raw_value_t &val, const string &reg, const string &tmp);
-static void EmitSPRelativeAccess(const string &inst, const string &data_reg, int offset, const string &temp_reg);
-static void MoveValueToRegister(const koopa_raw_value_t &val, const string &reg);
-static void MoveValueFromRegister(const koopa_raw_value_t &val, const string &reg);
+static bool IsImm12(long long imm);
+static void EmitAddressOffset(Reg dst, Reg base, const koopa_raw_value_t &index);
+static void LoadValueToRegister(const koopa_raw_value_t &val, Reg reg);
+static void SaveValueFromRegister(const koopa_raw_value_t &val, Reg reg, Reg tmp);
+static void EmitSPRelativeAccess(const string &inst, Reg data_reg, int offset, Reg temp_reg);
+static void MoveValueToRegister(const koopa_raw_value_t &val, Reg reg);
+static void MoveValueFromRegister(const koopa_raw_value_t &val, Reg reg);
+static Reg OperandRegister(const koopa_raw_value_t &val, Reg scratch);
+static Reg ResultRegister(const koopa_raw_value_t &val, Reg scratch);
+static bool IsTailCall(const koopa_raw_value_t &call);
+static void EmitEpilogue(const char *tail_callee = nullptr);
+static void EmitCalleeSaves(const string &inst);
 
 int get_array_size(const koopa_raw_type_t arr) {
   if(arr->tag == KOOPA_RTT_ARRAY) {
@@ -51,45 +159,597 @@ int get_array_size(const koopa_raw_type_t arr) {
   }
 }
 
+static ValueInfo &Info(const koopa_raw_value_t &val) {
+  int index = value_index.Find(val);
+  assert(index >= 0);
+  return value_infos[index];
+}
+
+// The first eight arguments are moved out of a0-a7 in the prologue like any
+// other value; the rest live in the caller's outgoing area, just above our frame.
+static ValueInfo ArgInfo(const koopa_raw_value_t &val) {
+  size_t index = val->kind.data.func_arg_ref.index;
+  if (index < 8) {
+    return Info(val);
+  }
+  return {stack_size + (int)(index - 8) * 4, Reg::zero, ValueType::STACK};
+}
+
+// Calls fn with the dense index of every operand of inst that is an
+// instruction result of the current function.
+template <typename Fn>
+static void ForEachLocalOperand(const koopa_raw_value_t &inst, Fn fn) {
+  auto visit = [&](koopa_raw_value_t operand) {
+    int index = operand ? value_index.Find(operand) : -1;
+    if (index >= 0) fn(index);
+  };
+  const auto &kind = inst->kind;
+  switch (kind.tag) {
+    case KOOPA_RVT_LOAD:
+      visit(kind.data.load.src);
+      break;
+    case KOOPA_RVT_STORE:
+      visit(kind.data.store.value);
+      visit(kind.data.store.dest);
+      break;
+    case KOOPA_RVT_GET_PTR:
+      visit(kind.data.get_ptr.src);
+      visit(kind.data.get_ptr.index);
+      break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+      visit(kind.data.get_elem_ptr.src);
+      visit(kind.data.get_elem_ptr.index);
+      break;
+    case KOOPA_RVT_BINARY:
+      visit(kind.data.binary.lhs);
+      visit(kind.data.binary.rhs);
+      break;
+    case KOOPA_RVT_BRANCH:
+      visit(kind.data.branch.cond);
+      break;
+    case KOOPA_RVT_CALL:
+      for (size_t i = 0; i < kind.data.call.args.len; ++i) {
+        visit(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[i]));
+      }
+      break;
+    case KOOPA_RVT_RETURN:
+      visit(kind.data.ret.value);
+      break;
+    default:
+      break;
+  }
+}
+
+static uint32_t CallClobbers(const koopa_raw_value_t &call) {
+  auto it = clobbered_regs.find(call->kind.data.call.callee);
+  return it == clobbered_regs.end() ? kCallerSavedRegs : it->second;
+}
+
+static vector<koopa_raw_basic_block_t> Successors(koopa_raw_basic_block_t bb) {
+  auto term = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+  if (term->kind.tag == KOOPA_RVT_BRANCH) {
+    return {term->kind.data.branch.true_bb, term->kind.data.branch.false_bb};
+  } else if (term->kind.tag == KOOPA_RVT_JUMP) {
+    return {term->kind.data.jump.target};
+  }
+  return {};
+}
+
+// Keeps scalars in registers. Values live across a call may not use the
+// registers it overwrites; the others prefer caller-saved ones, and leaf
+// functions may also use the argument registers, first, since their callers
+// never keep values there but may well in the t registers left untouched. An
+// argument only ever gets its own argument register among those, so the
+// prologue moves cannot clobber each other. Allocs qualify when plain. Values
+// that do not fit stay on the stack.
+static void AssignRegisters(const koopa_raw_function_t &func, const vector<koopa_raw_value_t> &values,
+                            const vector<vector<int>> &interference, const vector<uint32_t> &call_clobbers,
+                            const vector<bool> &plain) {
+  vector<Reg> pool;
+  uint32_t arg_regs = 0;
+  if (is_leaf) {
+    for (size_t i = 0; i < 8; ++i) {
+      arg_regs |= 1u << pool.size();
+      pool.push_back(ArgReg(i));
+    }
+  }
+  for (Reg reg : {Reg::t3, Reg::t4, Reg::t5, Reg::t6}) pool.push_back(reg);
+  for (Reg reg : {Reg::s0, Reg::s1, Reg::s2, Reg::s3, Reg::s4, Reg::s5,
+                  Reg::s6, Reg::s7, Reg::s8, Reg::s9, Reg::s10, Reg::s11}) {
+    pool.push_back(reg);
+  }
+  size_t value_num = values.size();
+  vector<bool> candidate(value_num);
+  vector<int> weight(value_num, 0);
+  // Loads from and stores to a promoted alloc become moves; try to give both
+  // sides the same register so that the move disappears.
+  vector<vector<int>> related(value_num);
+  for (size_t i = 0; i < value_num; ++i) {
+    candidate[i] = values[i]->kind.tag != KOOPA_RVT_ALLOC || plain[i];
+  }
+  for (size_t i = 0; i < func->bbs.len; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      ForEachLocalOperand(inst, [&](int index) { ++weight[index]; });
+      int index = value_index.Find(inst);
+      int other = -1;
+      if (inst->kind.tag == KOOPA_RVT_LOAD) {
+        other = value_index.Find(inst->kind.data.load.src);
+      } else if (inst->kind.tag == KOOPA_RVT_STORE) {
+        index = value_index.Find(inst->kind.data.store.value);
+        other = value_index.Find(inst->kind.data.store.dest);
+      }
+      if (index >= 0 && other >= 0) {
+        related[index].push_back(other);
+        related[other].push_back(index);
+      }
+    }
+  }
+
+  vector<int> order;
+  for (size_t i = 0; i < value_num; ++i) {
+    if (candidate[i]) order.push_back((int)i);
+  }
+  stable_sort(order.begin(), order.end(), [&](int a, int b) { return weight[a] > weight[b]; });
+  vector<int> color(value_num, -1);
+  // Values live across calls first try the callee-saved registers. Those
+  // left without one wait until the others have had their pick, so as not to
+  // take the registers the calls spare from the short-lived values around.
+  vector<int> deferred;
+  auto assign = [&](int v, bool last_round) {
+    uint32_t taken = 0;
+    for (size_t c = 0; c < pool.size(); ++c) {
+      if (call_clobbers[v] & RegBit(pool[c])) taken |= 1u << c;
+    }
+    for (int other : interference[v]) {
+      if (color[other] >= 0) taken |= 1u << color[other];
+    }
+    auto allowed = [&](int c) {
+      return !(taken >> c & 1) && (last_round || !call_clobbers[v] || IsCalleeSaved(pool[c]));
+    };
+    int chosen = -1;
+    if (values[v]->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
+      int own = (int)values[v]->kind.data.func_arg_ref.index;
+      if (is_leaf && allowed(own)) chosen = own;
+      taken |= arg_regs;
+    }
+    for (int other : related[v]) {
+      if (chosen < 0 && color[other] >= 0 && allowed(color[other])) chosen = color[other];
+    }
+    for (size_t c = 0; chosen < 0 && c < pool.size(); ++c) {
+      if (allowed((int)c)) chosen = (int)c;
+    }
+    if (chosen >= 0) {
+      color[v] = chosen;
+    } else if (!last_round && call_clobbers[v]) {
+      deferred.push_back(v);
+    }
+  };
+  for (int v : order) assign(v, false);
+  for (int v : deferred) assign(v, true);
+
+  // A callee-saved register costs a save and a restore. Its values move to
+  // a caller-saved one together if none of their neighbours has it and none
+  // of the calls they are live across overwrites it.
+  vector<vector<int>> members(pool.size());
+  for (size_t v = 0; v < value_num; ++v) {
+    if (color[v] >= 0) members[color[v]].push_back((int)v);
+  }
+  for (size_t from = 0; from < pool.size(); ++from) {
+    if (!IsCalleeSaved(pool[from]) || members[from].empty()) continue;
+    for (size_t to = 0; to < pool.size(); ++to) {
+      if (IsCalleeSaved(pool[to]) || (arg_regs >> to & 1)) continue;
+      bool free = all_of(members[from].begin(), members[from].end(), [&](int v) {
+        return !(call_clobbers[v] & RegBit(pool[to])) &&
+               none_of(interference[v].begin(), interference[v].end(), [&](int other) { return color[other] == (int)to; });
+      });
+      if (!free) continue;
+      for (int v : members[from]) color[v] = (int)to;
+      members[to].insert(members[to].end(), members[from].begin(), members[from].end());
+      members[from].clear();
+      break;
+    }
+  }
+  for (size_t v = 0; v < value_num; ++v) {
+    if (color[v] >= 0) value_infos[v] = {0, pool[color[v]], ValueType::REGISTER};
+  }
+}
+
+// Packs the frame objects of the current function into as little space as
+// possible: values and allocs whose lifetimes never overlap share offsets.
+// A use of an address derived from an alloc also counts as a use of the alloc,
+// so a frame object stays live while any pointer into it may be dereferenced.
+// Returns the size of the packed area.
+static int AssignStackSlots(const koopa_raw_function_t &func, int base_offset) {
+  size_t value_num = value_infos.size();
+  size_t words = (value_num + 63) / 64;
+  size_t bb_num = func->bbs.len;
+  vector<koopa_raw_value_t> values(value_num);
+  vector<int> sizes(value_num, 4), root(value_num, -1);
+  size_t arg_num = min((size_t)func->params.len, (size_t)8);
+  for (size_t i = 0; i < arg_num; ++i) {
+    values[i] = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+  }
+  unordered_map<koopa_raw_basic_block_t, size_t> bb_index;
+  for (size_t i = 0; i < bb_num; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    bb_index[bb] = i;
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      int index = value_index.Find(inst);
+      if (index < 0) continue;
+      values[index] = inst;
+      if (inst->kind.tag == KOOPA_RVT_ALLOC) {
+        sizes[index] = get_array_size(inst->ty);
+        root[index] = index;
+      } else if (inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR || inst->kind.tag == KOOPA_RVT_GET_PTR) {
+        auto src = inst->kind.tag == KOOPA_RVT_GET_PTR ? inst->kind.data.get_ptr.src : inst->kind.data.get_elem_ptr.src;
+        int src_index = value_index.Find(src);
+        if (src_index >= 0) root[index] = root[src_index];
+      }
+    }
+  }
+
+  // A plain alloc is a scalar whose address is only used by loads and stores.
+  // It behaves like a variable: a store to it is a definition, not a use.
+  vector<bool> plain(value_num, false);
+  for (size_t i = 0; i < value_num; ++i) {
+    plain[i] = values[i]->kind.tag == KOOPA_RVT_ALLOC && sizes[i] == 4 &&
+               values[i]->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY;
+  }
+  for (size_t i = 0; i < bb_num; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      ForEachLocalOperand(inst, [&](int index) {
+        if (values[index]->kind.tag != KOOPA_RVT_ALLOC) return;
+        bool address_only = inst->kind.tag == KOOPA_RVT_LOAD ||
+                            (inst->kind.tag == KOOPA_RVT_STORE && inst->kind.data.store.value != values[index]);
+        if (!address_only) plain[index] = false;
+      });
+    }
+  }
+  auto def_of = [&](koopa_raw_value_t inst) {
+    if (inst->kind.tag == KOOPA_RVT_STORE) {
+      int dest = value_index.Find(inst->kind.data.store.dest);
+      return dest >= 0 && plain[dest] ? dest : -1;
+    }
+    return value_index.Find(inst);
+  };
+
+  auto test = [](const vector<uint64_t> &set, int i) { return (set[i >> 6] >> (i & 63)) & 1; };
+  auto set_bit = [](vector<uint64_t> &set, int i) { set[i >> 6] |= 1ull << (i & 63); };
+  auto clear_bit = [](vector<uint64_t> &set, int i) { set[i >> 6] &= ~(1ull << (i & 63)); };
+  auto for_each_use = [&](koopa_raw_value_t inst, auto fn) {
+    int skip = inst->kind.tag == KOOPA_RVT_STORE ? def_of(inst) : -1;
+    ForEachLocalOperand(inst, [&](int index) {
+      if (index == skip) return;
+      fn(index);
+      if (root[index] >= 0 && root[index] != index) fn(root[index]);
+    });
+  };
+
+  vector<vector<uint64_t>> uses(bb_num, vector<uint64_t>(words)), defs = uses;
+  vector<vector<uint64_t>> live_in = uses, live_out = uses;
+  vector<vector<size_t>> succs(bb_num);
+  for (size_t i = 0; i < arg_num; ++i) set_bit(defs[0], (int)i);
+  for (size_t i = 0; i < bb_num; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (auto succ : Successors(bb)) succs[i].push_back(bb_index.at(succ));
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      for_each_use(inst, [&](int index) {
+        if (!test(defs[i], index)) set_bit(uses[i], index);
+      });
+      int index = def_of(inst);
+      if (index >= 0) set_bit(defs[i], index);
+    }
+  }
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = bb_num; i-- > 0;) {
+      for (auto succ : succs[i]) {
+        for (size_t w = 0; w < words; ++w) live_out[i][w] |= live_in[succ][w];
+      }
+      for (size_t w = 0; w < words; ++w) {
+        uint64_t in = uses[i][w] | (live_out[i][w] & ~defs[i][w]);
+        if (in != live_in[i][w]) {
+          live_in[i][w] = in;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // A value interferes with everything live right after its definition.
+  // The arguments are all defined together on entry.
+  vector<vector<int>> interference(value_num);
+  // The registers overwritten by the calls each value is live across.
+  vector<uint32_t> call_clobbers(value_num, 0);
+  auto define = [&](vector<uint64_t> &live, int def) {
+    clear_bit(live, def);
+    for (size_t w = 0; w < words; ++w) {
+      for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+        int other = (int)(w * 64 + __builtin_ctzll(bits));
+        interference[def].push_back(other);
+        interference[other].push_back(def);
+      }
+    }
+  };
+  for (size_t i = 0; i < bb_num; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    auto live = live_out[i];
+    for (size_t j = bb->insts.len; j-- > 0;) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      int def = def_of(inst);
+      if (def >= 0) {
+        define(live, def);
+      }
+      if (inst->kind.tag == KOOPA_RVT_CALL) {
+        uint32_t clobbers = CallClobbers(inst);
+        for (size_t w = 0; w < words; ++w) {
+          for (uint64_t bits = live[w]; bits; bits &= bits - 1) {
+            call_clobbers[w * 64 + __builtin_ctzll(bits)] |= clobbers;
+          }
+        }
+      }
+      for_each_use(inst, [&](int index) { set_bit(live, index); });
+    }
+    if (i == 0) {
+      for (size_t a = 0; a < arg_num; ++a) set_bit(live, (int)a);
+      for (size_t a = 0; a < arg_num; ++a) define(live, (int)a);
+    }
+  }
+
+  AssignRegisters(func, values, interference, call_clobbers, plain);
+
+  // Scalars first so that they get the small, directly addressable offsets.
+  vector<int> order(value_num);
+  for (size_t i = 0; i < value_num; ++i) order[i] = (int)i;
+  stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return (sizes[a] > 4) != (sizes[b] > 4) ? sizes[a] <= 4 : sizes[a] > sizes[b];
+  });
+  vector<int> offsets(value_num, -1);
+  int frame_size = 0;
+  vector<pair<int, int>> taken;
+  for (int v : order) {
+    if (value_infos[v].type == ValueType::REGISTER) continue;
+    taken.clear();
+    for (int other : interference[v]) {
+      if (offsets[other] >= 0) taken.push_back({offsets[other], offsets[other] + sizes[other]});
+    }
+    sort(taken.begin(), taken.end());
+    int offset = 0;
+    for (const auto &range : taken) {
+      if (range.first >= offset + sizes[v]) break;
+      offset = max(offset, range.second);
+    }
+    offsets[v] = offset;
+    frame_size = max(frame_size, offset + sizes[v]);
+    value_infos[v].offset = base_offset + offset;
+  }
+  return frame_size;
+}
+
+// Immediate dominators of the nodes reachable from root (Cooper, Harvey and
+// Kennedy). rpo receives each node's reverse postorder number, -1 if unreachable.
+static vector<int> ComputeIdom(int root, const vector<vector<int>> &succs,
+                               const vector<vector<int>> &preds, vector<int> &rpo) {
+  int n = (int)succs.size();
+  vector<int> order;
+  vector<int> idom(n, -1);
+  vector<size_t> next(n, 0);
+  vector<bool> visited(n, false);
+  vector<int> stack = {root};
+  visited[root] = true;
+  while (!stack.empty()) {
+    int node = stack.back();
+    if (next[node] < succs[node].size()) {
+      int succ = succs[node][next[node]++];
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack.push_back(succ);
+      }
+    } else {
+      order.push_back(node);
+      stack.pop_back();
+    }
+  }
+  reverse(order.begin(), order.end());
+  rpo.assign(n, -1);
+  for (size_t i = 0; i < order.size(); ++i) rpo[order[i]] = (int)i;
+
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (rpo[a] > rpo[b]) a = idom[a];
+      while (rpo[b] > rpo[a]) b = idom[b];
+    }
+    return a;
+  };
+  idom[root] = root;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); ++i) {
+      int node = order[i], new_idom = -1;
+      for (int pred : preds[node]) {
+        if (idom[pred] < 0) continue;
+        new_idom = new_idom < 0 ? pred : intersect(pred, new_idom);
+      }
+      if (new_idom != idom[node]) {
+        idom[node] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+// Shrink-wrapping: saves go to the nearest block dominating every block that
+// clobbers a saved register, restores to the nearest block post-dominating all
+// of them. Both points must lie outside loops so that they run once per call;
+// otherwise the saves stay in the prologue and the restores in the epilogue.
+static void PlaceCalleeSaves(const koopa_raw_function_t &func) {
+  auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+  save_block = entry;
+  restore_block = nullptr;
+  if (saved_regs.empty()) return;
+
+  // Node bb_num is a virtual exit following every return.
+  int bb_num = (int)func->bbs.len, exit = bb_num;
+  vector<vector<int>> succs(bb_num + 1), preds(bb_num + 1);
+  unordered_map<koopa_raw_basic_block_t, int> bb_index;
+  for (int i = 0; i < bb_num; ++i) {
+    bb_index[reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])] = i;
+  }
+  vector<bool> needs_save(bb_num, false);
+  for (size_t i = 0; i < min((size_t)func->params.len, (size_t)8); ++i) {
+    if (value_infos[i].type == ValueType::REGISTER && IsCalleeSaved(value_infos[i].reg)) needs_save[0] = true;
+  }
+  for (int i = 0; i < bb_num; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    auto next = Successors(bb);
+    if (next.empty()) {
+      succs[i].push_back(exit);
+    }
+    for (auto succ : next) succs[i].push_back(bb_index.at(succ));
+    for (int succ : succs[i]) preds[succ].push_back(i);
+    auto clobbers = [&](int index) {
+      const auto &info = value_infos[index];
+      if (info.type == ValueType::REGISTER && IsCalleeSaved(info.reg)) needs_save[i] = true;
+    };
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if (inst->kind.tag == KOOPA_RVT_CALL) needs_save[i] = true;
+      int index = value_index.Find(inst);
+      if (index >= 0) clobbers(index);
+      ForEachLocalOperand(inst, clobbers);
+    }
+  }
+
+  vector<int> dom_rpo, pdom_rpo;
+  auto idom = ComputeIdom(0, succs, preds, dom_rpo);
+  auto ipdom = ComputeIdom(exit, preds, succs, pdom_rpo);
+  auto nearest_common = [](const vector<int> &tree, const vector<int> &rpo, int a, int b) {
+    if (a < 0) return b;
+    while (a != b) {
+      while (rpo[a] > rpo[b]) a = tree[a];
+      while (rpo[b] > rpo[a]) b = tree[b];
+    }
+    return a;
+  };
+  int save = -1, restore = -1;
+  for (int i = 0; i < bb_num; ++i) {
+    if (!needs_save[i] || dom_rpo[i] < 0) continue;
+    // A block that never reaches a return has no post-dominating restore point.
+    if (pdom_rpo[i] < 0) return;
+    save = nearest_common(idom, dom_rpo, save, i);
+    restore = nearest_common(ipdom, pdom_rpo, restore, i);
+  }
+  if (save < 0 || pdom_rpo[save] < 0) return;
+  restore = nearest_common(ipdom, pdom_rpo, restore, save);
+  if (dom_rpo[restore] < 0) return;
+
+  int node = restore;
+  while (node != save && node != idom[node]) node = idom[node];
+  auto in_loop = [&](int start) {
+    vector<bool> seen(bb_num + 1, false);
+    vector<int> work(succs[start].begin(), succs[start].end());
+    while (!work.empty()) {
+      int cur = work.back();
+      work.pop_back();
+      if (cur == start) return true;
+      if (seen[cur]) continue;
+      seen[cur] = true;
+      work.insert(work.end(), succs[cur].begin(), succs[cur].end());
+    }
+    return false;
+  };
+  if (node != save || in_loop(save) || in_loop(restore)) return;
+  save_block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[save]);
+  if (restore != exit) {
+    restore_block = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[restore]);
+  }
+}
+
+// What calls of func overwrite: the scratch and argument registers, whichever
+// caller-saved ones its values got, and all its callees overwrite. Its own
+// calls are still unknown when in a cycle, so overwrite everything.
+static void RecordClobberedRegs(const koopa_raw_function_t &func) {
+  uint32_t regs = RegBit(Reg::ra) | RegBit(Reg::t0) | RegBit(Reg::t1) | RegBit(Reg::t2);
+  for (size_t i = 0; i < 8; ++i) regs |= RegBit(ArgReg(i));
+  for (const auto &info : value_infos) {
+    if (info.type == ValueType::REGISTER && !IsCalleeSaved(info.reg)) regs |= RegBit(info.reg);
+  }
+  for (size_t i = 0; i < func->bbs.len; ++i) {
+    auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    for (size_t j = 0; j < bb->insts.len; ++j) {
+      auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+      if (inst->kind.tag == KOOPA_RVT_CALL) regs |= CallClobbers(inst);
+    }
+  }
+  clobbered_regs[func] = regs;
+}
+
 void CalculateStackSize(const koopa_raw_function_t &func) {
   stack_size = 0;
   is_ra_saved = false;
+  is_leaf = true;
   int stack_param_num = 0;
+  size_t inst_num = 0;
   for (size_t i = 0; i < func->bbs.len; ++i) {
     auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+    inst_num += bb->insts.len;
     for (size_t j = 0; j < bb->insts.len; ++j) {
       auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
       if (inst->kind.tag == KOOPA_RVT_CALL) {
         is_ra_saved = true;
+        is_leaf = false;
         const auto &call = inst->kind.data.call;
         stack_param_num = max(stack_param_num, (int)call.args.len - 8);
       }
     }
   }
 
+  size_t arg_num = min((size_t)func->params.len, (size_t)8);
+  value_index.Reset(inst_num + arg_num);
+  value_infos.clear();
+  value_infos.reserve(inst_num + arg_num);
+  for (size_t i = 0; i < arg_num; ++i) {
+    value_index.Insert(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]), (int)i);
+    value_infos.push_back({0, Reg::zero, ValueType::STACK});
+  }
   for (size_t i = 0; i < func->bbs.len; ++i) {
     auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
     for (size_t j = 0; j < bb->insts.len; ++j) {
       auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
-      if (inst->kind.tag == KOOPA_RVT_ALLOC) {
-        ValueInfo info;
-        info.offset = stack_size + stack_param_num * 4;
-        info.type = ValueType::STACK;
-        value_info_map[inst] = info;
-        stack_size += get_array_size(inst->ty);
-      } else if (inst->ty->tag != KOOPA_RTT_UNIT) {
-        ValueInfo info;
-        info.offset = stack_size + stack_param_num * 4;
-        info.type = ValueType::STACK;
-        value_info_map[inst] = info;
-        stack_size += 4;
+      if (inst->ty->tag == KOOPA_RTT_UNIT) {
+        continue;
+      }
+      value_index.Insert(inst, (int)value_infos.size());
+      value_infos.push_back({0, Reg::zero, ValueType::STACK});
+    }
+  }
+  stack_size = AssignStackSlots(func, stack_param_num * 4);
+  saved_regs.clear();
+  if (is_ra_saved) {
+    saved_regs.push_back(Reg::ra);
+  }
+  for (Reg reg : {Reg::s0, Reg::s1, Reg::s2, Reg::s3, Reg::s4, Reg::s5,
+                  Reg::s6, Reg::s7, Reg::s8, Reg::s9, Reg::s10, Reg::s11}) {
+    for (const auto &info : value_infos) {
+      if (info.type == ValueType::REGISTER && info.reg == reg) {
+        saved_regs.push_back(reg);
+        break;
       }
     }
   }
-  stack_size = (stack_size + (int)is_ra_saved * 4 + stack_param_num * 4 + 15) / 16 * 16;
+  stack_size = (stack_size + (int)saved_regs.size() * 4 + stack_param_num * 4 + 15) / 16 * 16;
+  PlaceCalleeSaves(func);
+  RecordClobberedRegs(func);
 }
 
-static void EmitSPRelativeAccess(const string &inst, const string &data_reg, int offset, const string &temp_reg) {
+static void EmitSPRelativeAccess(const string &inst, Reg data_reg, int offset, Reg temp_reg) {
   if (offset >= -2048 && offset <= 2047) {
     ofs << "  " << inst << " " << data_reg << ", " << offset << "(sp)" << endl;
   } else {
@@ -99,9 +759,31 @@ static void EmitSPRelativeAccess(const string &inst, const string &data_reg, int
   }
 }
 
+// The functions of funcs ordered so that each comes after the functions it
+// calls, except for calls that close a cycle.
+static vector<koopa_raw_function_t> CalleesFirst(const koopa_raw_slice_t &funcs) {
+  vector<koopa_raw_function_t> order;
+  unordered_map<koopa_raw_function_t, bool> seen;
+  function<void(koopa_raw_function_t)> visit = [&](koopa_raw_function_t func) {
+    if (seen[func]) return;
+    seen[func] = true;
+    for (size_t i = 0; i < func->bbs.len; ++i) {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+      for (size_t j = 0; j < bb->insts.len; ++j) {
+        auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+        if (inst->kind.tag == KOOPA_RVT_CALL) visit(inst->kind.data.call.callee);
+      }
+    }
+    order.push_back(func);
+  };
+  for (size_t i = 0; i < funcs.len; ++i) visit(reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]));
+  return order;
+}
+
 static void Visit(const koopa_raw_program_t &program) {
   Visit(program.values);
-  Visit(program.funcs);
+  // Calls need to know what their callee overwrites.
+  for (auto func : CalleesFirst(program.funcs)) Visit(func);
 }
 
 static void Visit(const koopa_raw_slice_t &slice) {
@@ -125,6 +807,7 @@ static void Visit(const koopa_raw_slice_t &slice) {
 
 static void Visit(const koopa_raw_function_t &func) {
   if (func->bbs.len == 0) return;
+  current_func = func;
   current_func_name = string(func->name + 1);
   CalculateStackSize(func);
 
@@ -140,13 +823,30 @@ static void Visit(const koopa_raw_function_t &func) {
       ofs << "  add sp, sp, t0" << endl;
     }
   }
-  if (is_ra_saved) {
-    EmitSPRelativeAccess("sw", "ra", stack_size - 4, "t0");
+  for (size_t i = 0; i < func->bbs.len; ++i) {
+    next_bb = i + 1 < func->bbs.len ? reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i + 1]) : nullptr;
+    Visit(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
   }
-  Visit(func->bbs);
-  ofs << current_func_name << "_end:" << endl;
-  if (is_ra_saved) {
-    EmitSPRelativeAccess("lw", "ra", stack_size - 4, "t0");
+  // Leaf functions return in place; the others share one epilogue.
+  if (!is_leaf) {
+    ofs << current_func_name << "_end:" << endl;
+    EmitEpilogue();
+  }
+  ofs << endl;
+  value_index.Release();
+  vector<ValueInfo>().swap(value_infos);
+}
+
+static void EmitCalleeSaves(const string &inst) {
+  for (size_t i = 0; i < saved_regs.size(); ++i) {
+    EmitSPRelativeAccess(inst, saved_regs[i], stack_size - 4 * (int)(i + 1), Reg::t1);
+  }
+}
+
+// Tears the frame down, then returns, or jumps to tail_callee if given.
+static void EmitEpilogue(const char *tail_callee) {
+  if (!restore_block) {
+    EmitCalleeSaves("lw");
   }
   if (stack_size > 0) {
     if (stack_size <= 2047) {
@@ -156,13 +856,52 @@ static void Visit(const koopa_raw_function_t &func) {
       ofs << "  add sp, sp, t0" << endl;
     }
   }
-  ofs << "  ret" << endl << endl;
+  if (tail_callee) {
+    ofs << "  j " << tail_callee << endl;
+  } else {
+    ofs << "  ret" << endl;
+  }
+}
+
+// Whether call is followed by a return of its result and can be made by
+// jumping to the callee once the frame is gone: its arguments must all go in
+// registers, and none may point into the frame. The registers saved by the
+// block are restored right before it.
+static bool IsTailCall(const koopa_raw_value_t &call) {
+  auto len = current_bb->insts.len;
+  if (call->kind.tag != KOOPA_RVT_CALL || len < 2 || reinterpret_cast<koopa_raw_value_t>(current_bb->insts.buffer[len - 2]) != call) return false;
+  auto ret = reinterpret_cast<koopa_raw_value_t>(current_bb->insts.buffer[len - 1]);
+  if (ret->kind.tag != KOOPA_RVT_RETURN) return false;
+  if (ret->kind.data.ret.value ? ret->kind.data.ret.value != call : call->ty->tag != KOOPA_RTT_UNIT) return false;
+  if (restore_block && restore_block != current_bb) return false;
+  const auto &args = call->kind.data.call.args;
+  if (args.len > 8) return false;
+  // Addresses must derive from an argument or a global; anything else, an
+  // alloc wherever it sits or a pointer reloaded from one, may be the frame.
+  for (size_t i = 0; i < args.len; ++i) {
+    auto arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+    if (arg->ty->tag != KOOPA_RTT_POINTER) continue;
+    while (arg->kind.tag == KOOPA_RVT_GET_PTR || arg->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
+      arg = arg->kind.tag == KOOPA_RVT_GET_PTR ? arg->kind.data.get_ptr.src : arg->kind.data.get_elem_ptr.src;
+    }
+    if (arg->kind.tag != KOOPA_RVT_FUNC_ARG_REF && arg->kind.tag != KOOPA_RVT_GLOBAL_ALLOC) return false;
+  }
+  return true;
 }
 
 static void Visit(const koopa_raw_basic_block_t &bb) {
   if (string(bb->name + 1) != "entry") {
     ofs << current_func_name << "_" << bb->name + 1<< ":" << endl;
   }
+  current_bb = bb;
+  if (bb == save_block) {
+    EmitCalleeSaves("sw");
+  }
+  if (bb == reinterpret_cast<koopa_raw_basic_block_t>(current_func->bbs.buffer[0])) {
+    for (size_t i = 0; i < min((size_t)current_func->params.len, (size_t)8); ++i) {
+      MoveValueFromRegister(reinterpret_cast<koopa_raw_value_t>(current_func->params.buffer[i]), ArgReg(i));
+    }
+  }
   Visit(bb->insts);
 }
 
@@ -171,45 +910,74 @@ static void Visit(const koopa_raw_value_t &value) {
   switch (kind.tag) {
     case KOOPA_RVT_RETURN: {
       const auto &ret = kind.data.ret;
+      // The call before already left.
+      auto len = current_bb->insts.len;
+      if (len >= 2 && IsTailCall(reinterpret_cast<koopa_raw_value_t>(current_bb->insts.buffer[len - 2]))) {
+        break;
+      }
       if (ret.value) {
-        MoveValueToRegister(ret.value, "a0");
+        MoveValueToRegister(ret.value, Reg::a0);
+      }
+      if (current_bb == restore_block) {
+        EmitCalleeSaves("lw");
+      }
+      if (is_leaf) {
+        EmitEpilogue();
+      } else if (next_bb) {
+        ofs << "  j " << current_func_name << "_end" << endl;
       }
-      ofs << "  j " << current_func_name << "_end" << endl;
       break;
     }
     case KOOPA_RVT_BINARY: {
       const auto &binary = kind.data.binary;
-      MoveValueToRegister(binary.lhs, "t0");
-      MoveValueToRegister(binary.rhs, "t1");
+      // Adding or subtracting a constant that fits in 12 bits takes an addi.
+      if (binary.op == KOOPA_RBO_ADD || binary.op == KOOPA_RBO_SUB) {
+        auto base = binary.lhs, constant = binary.rhs;
+        if (binary.op == KOOPA_RBO_ADD && base->kind.tag == KOOPA_RVT_INTEGER) swap(base, constant);
+        if (constant->kind.tag == KOOPA_RVT_INTEGER) {
+          int64_t imm = constant->kind.data.integer.value;
+          if (binary.op == KOOPA_RBO_SUB) imm = -imm;
+          if (imm >= -2048 && imm < 2048) {
+            Reg src = OperandRegister(base, Reg::t0);
+            Reg dst = ResultRegister(value, Reg::t0);
+            ofs << "  addi " << dst << ", " << src << ", " << imm << endl;
+            MoveValueFromRegister(value, dst);
+            break;
+          }
+        }
+      }
+      Reg lhs = OperandRegister(binary.lhs, Reg::t0);
+      Reg rhs = OperandRegister(binary.rhs, Reg::t1);
+      Reg dst = ResultRegister(value, Reg::t0);
       switch (binary.op) {
-        case KOOPA_RBO_ADD: ofs << "  add t0, t0, t1" << endl; break;
-        case KOOPA_RBO_SUB: ofs << "  sub t0, t0, t1" << endl; break;
-        case KOOPA_RBO_MUL: ofs << "  mul t0, t0, t1" << endl; break;
-        case KOOPA_RBO_DIV: ofs << "  div t0, t0, t1" << endl; break;
-        case KOOPA_RBO_MOD: ofs << "  rem t0, t0, t1" << endl; break;
-        case KOOPA_RBO_EQ: ofs << "  xor t0, t0, t1" << endl; ofs << "  seqz t0, t0" << endl; break;
-        case KOOPA_RBO_NOT_EQ: ofs << "  xor t0, t0, t1" << endl; ofs << "  snez t0, t0" << endl; break;
-        case KOOPA_RBO_GT: ofs << "  sgt t0, t0, t1" << endl; break;
-        case KOOPA_RBO_LT: ofs << "  slt t0, t0, t1" << endl; break;
-        case KOOPA_RBO_GE: ofs << "  slt t0, t0, t1" << endl; ofs << "  seqz t0, t0" << endl; break;
-        case KOOPA_RBO_LE: ofs << "  sgt t0, t0, t1" << endl; ofs << "  seqz t0, t0" << endl; break;
-        case KOOPA_RBO_AND: ofs << "  snez t0, t0" << endl; ofs << "  snez t1, t1" << endl; ofs << "  and t0, t0, t1" << endl; break;
-        case KOOPA_RBO_OR: ofs << "  or t0, t0, t1" << endl; ofs << "  snez t0, t0" << endl; break;
+        case KOOPA_RBO_ADD: ofs << "  add " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_SUB: ofs << "  sub " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_MUL: ofs << "  mul " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_DIV: ofs << "  div " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_MOD: ofs << "  rem " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_EQ: ofs << "  xor " << dst << ", " << lhs << ", " << rhs << endl; ofs << "  seqz " << dst << ", " << dst << endl; break;
+        case KOOPA_RBO_NOT_EQ: ofs << "  xor " << dst << ", " << lhs << ", " << rhs << endl; ofs << "  snez " << dst << ", " << dst << endl; break;
+        case KOOPA_RBO_GT: ofs << "  sgt " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_LT: ofs << "  slt " << dst << ", " << lhs << ", " << rhs << endl; break;
+        case KOOPA_RBO_GE: ofs << "  slt " << dst << ", " << lhs << ", " << rhs << endl; ofs << "  seqz " << dst << ", " << dst << endl; break;
+        case KOOPA_RBO_LE: ofs << "  sgt " << dst << ", " << lhs << ", " << rhs << endl; ofs << "  seqz " << dst << ", " << dst << endl; break;
+        case KOOPA_RBO_AND: ofs << "  snez t0, " << lhs << endl; ofs << "  snez t1, " << rhs << endl; ofs << "  and " << dst << ", t0, t1" << endl; break;
+        case KOOPA_RBO_OR: ofs << "  or " << dst << ", " << lhs << ", " << rhs << endl; ofs << "  snez " << dst << ", " << dst << endl; break;
         default: assert(false);
       }
-      MoveValueFromRegister(value, "t0");
+      MoveValueFromRegister(value, dst);
       break;
     }
     case KOOPA_RVT_LOAD: {
       const auto &load = kind.data.load;
-      LoadValueToRegister(load.src, "t0");
-      MoveValueFromRegister(value, "t0");
+      Reg dst = ResultRegister(value, Reg::t0);
+      LoadValueToRegister(load.src, dst);
+      MoveValueFromRegister(value, dst);
       break;
     }
     case KOOPA_RVT_STORE: {
       const auto &store = kind.data.store;
-      MoveValueToRegister(store.value, "t0");
-      SaveValueFromRegister(store.dest, "t0", "t1");
+      SaveValueFromRegister(store.dest, OperandRegister(store.value, Reg::t0), Reg::t1);
       break;
     }
     case KOOPA_RVT_INTEGER:
@@ -217,14 +985,33 @@ static void Visit(const koopa_raw_value_t &value) {
       break;
     case KOOPA_RVT_BRANCH: {
       const auto &branch = kind.data.branch;
-      MoveValueToRegister(branch.cond, "t0");
-      ofs << "  bnez t0, " << current_func_name << "_" << branch.true_bb->name + 1 << endl;
-      ofs << "  j " << current_func_name << "_" << branch.false_bb->name + 1 << endl;
+      Reg cond = OperandRegister(branch.cond, Reg::t0);
+      if (current_bb == restore_block) {
+        if (IsCalleeSaved(cond)) {
+          ofs << "  mv t0, " << cond << endl;
+          cond = Reg::t0;
+        }
+        EmitCalleeSaves("lw");
+      }
+      // Fall through to whichever target comes next.
+      if (branch.true_bb == next_bb) {
+        ofs << "  beqz " << cond << ", " << current_func_name << "_" << branch.false_bb->name + 1 << endl;
+        break;
+      }
+      ofs << "  bnez " << cond << ", " << current_func_name << "_" << branch.true_bb->name + 1 << endl;
+      if (branch.false_bb != next_bb) {
+        ofs << "  j " << current_func_name << "_" << branch.false_bb->name + 1 << endl;
+      }
       break;
     }
     case KOOPA_RVT_JUMP: {
       const auto &jump = kind.data.jump;
-      ofs << "  j " << current_func_name << "_" << jump.target->name + 1 << endl;
+      if (current_bb == restore_block) {
+        EmitCalleeSaves("lw");
+      }
+      if (jump.target != next_bb) {
+        ofs << "  j " << current_func_name << "_" << jump.target->name + 1 << endl;
+      }
       break;
     }
     case KOOPA_RVT_CALL: {
@@ -232,40 +1019,39 @@ static void Visit(const koopa_raw_value_t &value) {
       for (size_t i = 0; i < call.args.len; ++i) {
         auto arg_val = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
         if (i < 8) {
-          MoveValueToRegister(arg_val, "a" + to_string(i));
+          MoveValueToRegister(arg_val, ArgReg(i));
         } else {
-          MoveValueToRegister(arg_val, "t0");
-          EmitSPRelativeAccess("sw", "t0", (int)(i - 8) * 4, "t1");
+          MoveValueToRegister(arg_val, Reg::t0);
+          EmitSPRelativeAccess("sw", Reg::t0, (int)(i - 8) * 4, Reg::t1);
+        }
+      }
+      if (IsTailCall(value)) {
+        if (current_bb == restore_block) {
+          EmitCalleeSaves("lw");
         }
+        EmitEpilogue(call.callee->name + 1);
+        break;
       }
       ofs << "  call " << call.callee->name + 1 << endl;
       if (value->ty->tag != KOOPA_RTT_UNIT) {
-        MoveValueFromRegister(value, "a0");
+        MoveValueFromRegister(value, Reg::a0);
       }
       break;
     }
-    case KOOPA_RVT_FUNC_ARG_REF: {
-      int index = value->kind.data.func_arg_ref.index;
-      ValueInfo info;
-      if (index < 8) {
-        info.type = ValueType::REGISTER;
-        info.reg = "a" + to_string(index);
-      } else {
-        info.type = ValueType::STACK;
-        info.offset = stack_size + (index - 8) * 4;
-      }
-      value_info_map[value] = info;
+    case KOOPA_RVT_FUNC_ARG_REF:
       break;
-    }
     case KOOPA_RVT_GLOBAL_ALLOC: {
-      ofs << "  .data" << endl;
-      ofs << "  .globl " << value->name + 1 << endl;
-      ofs << value->name + 1 << ":" << endl;
-      ValueInfo info;
-      info.type = ValueType::GLOBAL;
-      value_info_map[value] = info;
       const auto &global_alloc = value->kind.data.global_alloc;
       const auto &init = global_alloc.init;
+      if (readonly_global_names.count(value->name + 1)) {
+        ofs << "  .section .rodata" << endl;
+      } else if (init->kind.tag == KOOPA_RVT_ZERO_INIT) {
+        ofs << "  .bss" << endl;
+      } else {
+        ofs << "  .data" << endl;
+      }
+      ofs << "  .globl " << value->name + 1 << endl;
+      ofs << value->name + 1 << ":" << endl;
       if (init->kind.tag == KOOPA_RVT_ZERO_INIT) {
         ofs << "  .zero " << get_array_size(value->ty) << endl;
       } else if (init->kind.tag == KOOPA_RVT_AGGREGATE) {
@@ -285,10 +1071,18 @@ static void Visit(const koopa_raw_value_t &value) {
     case KOOPA_RVT_GET_ELEM_PTR: {
       const auto &get_elem_ptr = kind.data.get_elem_ptr;
       const auto &src = get_elem_ptr.src;
-      if (value_info_map.at(src).type == ValueType::GLOBAL) {
+      const auto &index_val = get_elem_ptr.index;
+      Reg dst = ResultRegister(value, Reg::t0);
+      if (src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
         ofs << "  la t0, " << src->name + 1 << endl;
       } else {
-        int offset = value_info_map.at(src).offset;
+        int offset = Info(src).offset;
+        // A constant index folds into the frame offset.
+        if (index_val->kind.tag == KOOPA_RVT_INTEGER && IsImm12(offset + index_val->kind.data.integer.value * 4LL)) {
+          ofs << "  addi " << dst << ", sp, " << offset + index_val->kind.data.integer.value * 4 << endl;
+          MoveValueFromRegister(value, dst);
+          break;
+        }
         if (offset >= -2048 && offset <= 2047) {
             ofs << "  addi t0, sp, " << offset << endl;
         } else {
@@ -296,26 +1090,22 @@ static void Visit(const koopa_raw_value_t &value) {
             ofs << "  add t0, sp, t1" << endl;
         }
       }
-      MoveValueToRegister(get_elem_ptr.index, "t1");
-      ofs << "  li t2, 4" << endl;
-      ofs << "  mul t1, t1, t2" << endl;
-      ofs << "  add t0, t0, t1" << endl;
-      EmitSPRelativeAccess("sw", "t0", value_info_map.at(value).offset, "t1");
+      EmitAddressOffset(dst, Reg::t0, index_val);
+      MoveValueFromRegister(value, dst);
       break;
     }
     case KOOPA_RVT_GET_PTR: {
       const auto &get_ptr = kind.data.get_ptr;
       const auto &src = get_ptr.src;
-      if (value_info_map.at(src).type == ValueType::GLOBAL) {
+      Reg base = Reg::t0;
+      if (src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) {
         ofs << "  la t0, " << src->name + 1 << endl;
       } else {
-        MoveValueToRegister(src, "t0");
+        base = OperandRegister(src, Reg::t0);
       }
-      MoveValueToRegister(get_ptr.index, "t1");
-      ofs << "  li t2, 4" << endl;
-      ofs << "  mul t1, t1, t2" << endl;
-      ofs << "  add t0, t0, t1" << endl;
-      EmitSPRelativeAccess("sw", "t0", value_info_map.at(value).offset, "t1");
+      Reg dst = ResultRegister(value, Reg::t0);
+      EmitAddressOffset(dst, base, get_ptr.index);
+      MoveValueFromRegister(value, dst);
       break;
     }
     default:
@@ -323,79 +1113,122 @@ static void Visit(const koopa_raw_value_t &value) {
   }
 }
 
-static void LoadValueToRegister(const koopa_raw_value_t &val, const string &reg) {
-  if (val->kind.tag == KOOPA_RVT_INTEGER) {
-    ofs << "  li " << reg << ", " << val->kind.data.integer.value << endl;
-  } else if (val->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
-    if (value_info_map.find(val) == value_info_map.end()) {
-        Visit(val);
-    }
-    auto info = value_info_map.at(val);
-    if (info.type == ValueType::REGISTER) {
-      ofs << "  mv " << reg << ", " << info.reg << endl;
-    } else {
-      EmitSPRelativeAccess("lw", reg, info.offset, "t2");
-    }
-  } else if (val->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
+static bool IsImm12(long long imm) {
+  return imm >= -2048 && imm <= 2047;
+}
+
+// Emits dst = base + index * 4, with an addi when the index is a constant.
+static void EmitAddressOffset(Reg dst, Reg base, const koopa_raw_value_t &index) {
+  if (index->kind.tag == KOOPA_RVT_INTEGER && IsImm12(index->kind.data.integer.value * 4LL)) {
+    int offset = index->kind.data.integer.value * 4;
+    if (offset != 0 || dst != base) ofs << "  addi " << dst << ", " << base << ", " << offset << endl;
+    return;
+  }
+  Reg index_reg = OperandRegister(index, Reg::t1);
+  ofs << "  slli t1, " << index_reg << ", 2" << endl;
+  ofs << "  add " << dst << ", " << base << ", t1" << endl;
+}
+
+static void LoadValueToRegister(const koopa_raw_value_t &val, Reg reg) {
+  if (val->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
     ofs << "  la " << reg << ", " << val->name + 1 << endl;
     ofs << "  lw " << reg << ", 0(" << reg << ")" << endl;
-  } else if (val->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
-    EmitSPRelativeAccess("lw", reg, value_info_map.at(val).offset, "t2");
-    ofs << "  lw " << reg << ", 0(" << reg << ")" << endl;
-  } else if (val->kind.tag == KOOPA_RVT_GET_PTR){
-    EmitSPRelativeAccess("lw", reg, value_info_map.at(val).offset, "t2");
-    ofs << "  lw " << reg << ", 0(" << reg << ")" << endl;
+  } else if (val->kind.tag != KOOPA_RVT_ALLOC) {
+    // Any other address is a pointer value: a getelemptr, a getptr, a pointer
+    // argument or a pointer loaded from a phi slot.
+    Reg addr = OperandRegister(val, reg);
+    ofs << "  lw " << reg << ", 0(" << addr << ")" << endl;
+  } else if (Info(val).type == ValueType::REGISTER) {
+    if (Info(val).reg != reg) {
+      ofs << "  mv " << reg << ", " << Info(val).reg << endl;
+    }
   } else {
-    EmitSPRelativeAccess("lw", reg, value_info_map.at(val).offset, "t2");
+    EmitSPRelativeAccess("lw", reg, Info(val).offset, Reg::t2);
   }
 }
 
-static void SaveValueFromRegister(const koopa_raw_value_t &val, const string &reg, const string &tmp) {
+static void SaveValueFromRegister(const koopa_raw_value_t &val, Reg reg, Reg tmp) {
   if (val->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
     ofs << "  la " << tmp << ", " << val->name + 1 << endl;
     ofs << "  sw " << reg << ", 0(" << tmp << ")" << endl;
-  } else if (val->kind.tag == KOOPA_RVT_GET_ELEM_PTR) {
-    EmitSPRelativeAccess("lw", tmp, value_info_map.at(val).offset, "t2");
-    ofs << "  sw " << reg << ", 0(" << tmp << ")" << endl;
-  } else if (val->kind.tag == KOOPA_RVT_GET_PTR) {
-    EmitSPRelativeAccess("lw", tmp, value_info_map.at(val).offset, "t2");
-    ofs << "  sw " << reg << ", 0(" << tmp << ")" << endl;
+  } else if (val->kind.tag != KOOPA_RVT_ALLOC) {
+    Reg addr = OperandRegister(val, tmp);
+    ofs << "  sw " << reg << ", 0(" << addr << ")" << endl;
+  } else if (Info(val).type == ValueType::REGISTER) {
+    if (Info(val).reg != reg) {
+      ofs << "  mv " << Info(val).reg << ", " << reg << endl;
+    }
   } else {
-    EmitSPRelativeAccess("sw", reg, value_info_map.at(val).offset, tmp);
+    EmitSPRelativeAccess("sw", reg, Info(val).offset, tmp);
   }
 }
 
-static void MoveValueToRegister(const koopa_raw_value_t &val, const string &reg) {
+static void MoveValueToRegister(const koopa_raw_value_t &val, Reg reg) {
   if (val->kind.tag == KOOPA_RVT_INTEGER) {
     ofs << "  li " << reg << ", " << val->kind.data.integer.value << endl;
   } else if (val->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
-    if (value_info_map.find(val) == value_info_map.end()) {
-        Visit(val);
-    }
-    auto info = value_info_map.at(val);
+    auto info = ArgInfo(val);
     if (info.type == ValueType::REGISTER) {
       ofs << "  mv " << reg << ", " << info.reg << endl;
     } else {
-      EmitSPRelativeAccess("lw", reg, info.offset, "t2");
+      EmitSPRelativeAccess("lw", reg, info.offset, Reg::t2);
+    }
+  } else if (Info(val).type == ValueType::REGISTER) {
+    if (Info(val).reg != reg) {
+      ofs << "  mv " << reg << ", " << Info(val).reg << endl;
     }
   } else {
-    EmitSPRelativeAccess("lw", reg, value_info_map.at(val).offset, "t2");
+    EmitSPRelativeAccess("lw", reg, Info(val).offset, Reg::t2);
   }
 }
 
-static void MoveValueFromRegister(const koopa_raw_value_t &val, const string &reg) {
+static void MoveValueFromRegister(const koopa_raw_value_t &val, Reg reg) {
   if (val->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
     ofs << "  la " << reg << ", " << val->name + 1 << endl;
+  } else if (Info(val).type == ValueType::REGISTER) {
+    if (Info(val).reg != reg) {
+      ofs << "  mv " << Info(val).reg << ", " << reg << endl;
+    }
   } else {
-    EmitSPRelativeAccess("sw", reg, value_info_map.at(val).offset, "t2");
+    EmitSPRelativeAccess("sw", reg, Info(val).offset, Reg::t2);
+  }
+}
+
+// Returns the register that already holds val, or loads val into scratch.
+static Reg OperandRegister(const koopa_raw_value_t &val, Reg scratch) {
+  if (val->kind.tag == KOOPA_RVT_INTEGER) {
+    if (val->kind.data.integer.value == 0) return Reg::zero;
+  } else if (val->kind.tag == KOOPA_RVT_FUNC_ARG_REF) {
+    auto info = ArgInfo(val);
+    if (info.type == ValueType::REGISTER) return info.reg;
+  } else if (val->kind.tag != KOOPA_RVT_GLOBAL_ALLOC && Info(val).type == ValueType::REGISTER) {
+    return Info(val).reg;
   }
+  MoveValueToRegister(val, scratch);
+  return scratch;
+}
+
+// Returns the register the result of val should be computed into.
+static Reg ResultRegister(const koopa_raw_value_t &val, Reg scratch) {
+  const auto &info = Info(val);
+  return info.type == ValueType::REGISTER ? info.reg : scratch;
 }
 
+// Usage: compiler -koopa|-riscv input -o output [-fmemoize]
 int main(int argc, const char *argv[]) {
-  assert(argc == 5);
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   auto output = argv[4];
+  OptimizeOptions options;
+  for (int i = 5; i < argc; ++i) {
+    if (string(argv[i]) == "-fmemoize") {
+      options.memoize = true;
+    } else {
+      cerr << "unknown option " << argv[i] << endl;
+      return 1;
+    }
+  }
 
   yyin = fopen(input, "r");
   assert(yyin);
@@ -405,14 +1238,14 @@ int main(int argc, const char *argv[]) {
   assert(!ret);
 
   ofs.open(output);
+  stringstream ss;
+  ss << *ast;
+  string ir = OptimizeKoopa(ss.str(), options, readonly_global_names);
   if (string(mode) == "-koopa") {
-    ofs << *ast;
+    ofs << ir;
   } else if (string(mode) == "-riscv") {
-    stringstream ss;
-    ss << *ast;
-
     koopa_program_t program;
-    koopa_error_code_t parse_ret = koopa_parse_from_string(ss.str().c_str(), &program);
+    koopa_error_code_t parse_ret = koopa_parse_from_string(ir.c_str(), &program);
     assert(parse_ret == KOOPA_EC_SUCCESS);
     koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
     koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
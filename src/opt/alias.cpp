@@ -0,0 +1,88 @@
+#include "ir.h"
+
+using namespace std;
+
+Value *PointerRoot(Value *ptr, int *offset) {
+  *offset = 0;
+  while (ptr->op == Op::GET_PTR || ptr->op == Op::GET_ELEM_PTR) {
+    auto index = ptr->operands[1];
+    auto src = ptr->operands[0];
+    if (*offset >= 0 && index->IsConst()) {
+      auto pointee = src->ty->base;
+      int stride = ptr->op == Op::GET_PTR ? pointee->Size() : pointee->base->Size();
+      *offset += index->imm * stride;
+    } else {
+      *offset = -1;
+    }
+    ptr = src;
+  }
+  if (ptr->op == Op::ALLOC || ptr->op == Op::GLOBAL || ptr->op == Op::ARG) return ptr;
+  return nullptr;
+}
+
+// Whether the objects reached from the roots root_a and root_b, as returned
+// by PointerRoot, may be the same.
+static bool MaySameObject(Value *root_a, Value *root_b) {
+  if (!root_a || !root_b || root_a == root_b) return true;
+  // Distinct objects never overlap, and a pointer argument cannot point into
+  // the locals of the function receiving it. Two arguments, or an argument
+  // and a global, may well be the same array.
+  if (root_a->op == Op::ARG || root_b->op == Op::ARG) {
+    return root_a->op != Op::ALLOC && root_b->op != Op::ALLOC;
+  }
+  return false;
+}
+
+bool MayAlias(Value *a, Value *b) {
+  if (IsConstantMemory(a) || IsConstantMemory(b)) return false;
+  int offset_a, offset_b;
+  auto root_a = PointerRoot(a, &offset_a), root_b = PointerRoot(b, &offset_b);
+  if (root_a && root_a == root_b) return offset_a < 0 || offset_b < 0 || offset_a == offset_b;
+  return MaySameObject(root_a, root_b);
+}
+
+bool IsConstantMemory(Value *ptr) {
+  int offset;
+  auto root = PointerRoot(ptr, &offset);
+  return root && root->constant;
+}
+
+Value *LoadedConstant(Module &module, Value *ptr) {
+  int offset;
+  auto root = PointerRoot(ptr, &offset);
+  if (!root || !root->constant || offset < 0 || offset >= root->ty->base->Size()) return nullptr;
+  size_t index = offset / 4;
+  return module.Const(index < root->init.size() ? root->init[index] : 0);
+}
+
+unordered_set<Value *> EscapedAllocs(Function &func) {
+  unordered_set<Value *> escaped;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (inst->op != Op::CALL) continue;
+      for (auto arg : inst->operands) {
+        if (auto root = LocalRoot(arg)) escaped.insert(root);
+      }
+    }
+  }
+  return escaped;
+}
+
+bool CallMayClobber(Value *call, Value *ptr, const unordered_set<Value *> &escaped) {
+  return !call->callee->readonly && !IsConstantMemory(ptr) && CallMayAccess(call, ptr, escaped);
+}
+
+bool CallMayAccess(Value *call, Value *ptr, const unordered_set<Value *> &escaped) {
+  auto callee = call->callee;
+  if (callee->pure) return false;
+  auto root = LocalRoot(ptr);
+  if (root && !escaped.count(root)) return false;
+  if (!callee->argmemonly) return true;
+  // Anywhere in the objects its pointer arguments point into.
+  int offset;
+  auto ptr_root = PointerRoot(ptr, &offset);
+  for (auto arg : call->operands) {
+    if (arg->ty->tag == Type::POINTER && MaySameObject(PointerRoot(arg, &offset), ptr_root)) return true;
+  }
+  return false;
+}
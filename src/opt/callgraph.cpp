@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <functional>
+#include "ir.h"
+
+using namespace std;
+
+vector<Function *> Callees(const Function &func) {
+  vector<Function *> callees;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::CALL && find(callees.begin(), callees.end(), inst->callee) == callees.end()) {
+        callees.push_back(inst->callee);
+      }
+    }
+  }
+  return callees;
+}
+
+vector<vector<Function *>> CallGraphSCCs(const Module &module) {
+  // Tarjan's algorithm, which emits every component after the components it
+  // calls into.
+  vector<vector<Function *>> sccs;
+  unordered_map<Function *, int> index, low;
+  unordered_set<Function *> on_stack;
+  vector<Function *> stack;
+  int next_index = 0;
+  function<void(Function *)> visit = [&](Function *func) {
+    index[func] = low[func] = next_index++;
+    stack.push_back(func);
+    on_stack.insert(func);
+    for (auto callee : Callees(*func)) {
+      if (callee->IsDeclaration()) continue;
+      if (!index.count(callee)) {
+        visit(callee);
+        low[func] = min(low[func], low[callee]);
+      } else if (on_stack.count(callee)) {
+        low[func] = min(low[func], index[callee]);
+      }
+    }
+    if (low[func] != index[func]) return;
+    sccs.emplace_back();
+    Function *member;
+    do {
+      member = stack.back();
+      stack.pop_back();
+      on_stack.erase(member);
+      sccs.back().push_back(member);
+    } while (member != func);
+  };
+  for (auto func : module.functions) {
+    if (!func->IsDeclaration() && !index.count(func)) visit(func);
+  }
+  return sccs;
+}
+
+bool RemoveUncalledFunctions(Module &module) {
+  unordered_map<Function *, int> call_sites;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        if (inst->op == Op::CALL) ++call_sites[inst->callee];
+      }
+    }
+  }
+  // Dropping a function also drops the calls it made.
+  unordered_set<Function *> dead;
+  for (bool again = true; again;) {
+    again = false;
+    for (auto func : module.functions) {
+      if (func->IsDeclaration() || func->name == "main" || call_sites[func] || !dead.insert(func).second) continue;
+      for (auto bb : func->blocks) {
+        for (auto inst : bb->insts) {
+          if (inst->op == Op::CALL) --call_sites[inst->callee];
+        }
+      }
+      again = true;
+    }
+  }
+  module.functions.erase(remove_if(module.functions.begin(), module.functions.end(),
+                                   [&](Function *func) { return dead.count(func); }),
+                         module.functions.end());
+  return !dead.empty();
+}
+
+bool IsRecursive(const vector<Function *> &scc) {
+  if (scc.size() > 1) return true;
+  auto callees = Callees(*scc[0]);
+  return find(callees.begin(), callees.end(), scc[0]) != callees.end();
+}
+
+// The runtime library only does I/O, reading or writing the arrays passed to
+// getarray and putarray, and never calls back into the program.
+static void SetRuntimeAttributes(Function &func) {
+  static const unordered_set<string> runtime = {"getint", "getch", "getarray", "putint",
+                                                "putch", "putarray", "starttime", "stoptime"};
+  if (!runtime.count(func.name)) return;
+  func.argmemonly = true;
+  func.norecurse = true;
+  func.willreturn = true;
+}
+
+// Whether control can come back around to a block of func, which might then
+// go on forever.
+static bool HasLoop(const Function &func) {
+  unordered_map<BasicBlock *, int> state;  // 1 while on the path, 2 when done
+  function<bool(BasicBlock *)> visit = [&](BasicBlock *bb) {
+    state[bb] = 1;
+    for (auto succ : bb->Terminator()->blocks) {
+      if (state[succ] == 1 || (!state[succ] && visit(succ))) return true;
+    }
+    state[bb] = 2;
+    return false;
+  };
+  return visit(func.Entry());
+}
+
+// Whether the memory at ptr, not a local, can only be reached through the
+// arguments of the function.
+static bool IsArgMemory(Value *ptr) {
+  int offset;
+  auto root = PointerRoot(ptr, &offset);
+  return root && root->op == Op::ARG;
+}
+
+void InferAttributes(Module &module) {
+  for (auto func : module.functions) {
+    func->pure = func->readonly = func->argmemonly = func->norecurse = func->willreturn = false;
+    if (func->IsDeclaration()) SetRuntimeAttributes(*func);
+  }
+  for (const auto &scc : CallGraphSCCs(module)) {
+    bool reads = false, writes = false, global_memory = false;
+    bool returns = !IsRecursive(scc);
+    for (auto func : scc) {
+      returns = returns && !HasLoop(*func);
+      for (auto bb : func->blocks) {
+        for (auto inst : bb->insts) {
+          if (inst->op == Op::LOAD || inst->op == Op::STORE) {
+            auto ptr = inst->operands[inst->op == Op::LOAD ? 0 : 1];
+            // Constant globals hold the same whenever they are read.
+            if (LocalRoot(ptr) || IsConstantMemory(ptr)) continue;
+            (inst->op == Op::LOAD ? reads : writes) = true;
+            global_memory |= !IsArgMemory(ptr);
+          } else if (inst->op == Op::CALL) {
+            auto callee = inst->callee;
+            returns &= callee->willreturn;
+            if (find(scc.begin(), scc.end(), callee) != scc.end() || callee->pure) continue;
+            // The callee may touch whatever its pointer arguments point to;
+            // reading locals or constants only is as good as being pure.
+            bool local = callee->argmemonly;
+            for (auto arg : inst->operands) {
+              if (arg->ty->tag != Type::POINTER || LocalRoot(arg) || IsConstantMemory(arg)) continue;
+              local = false;
+              global_memory |= !IsArgMemory(arg);
+            }
+            if (callee->readonly && local) continue;
+            (callee->readonly ? reads : writes) = true;
+            global_memory |= !callee->argmemonly;
+          }
+        }
+      }
+    }
+    bool recursive = IsRecursive(scc);
+    for (auto func : scc) {
+      func->pure = !reads && !writes;
+      func->readonly = !writes;
+      func->argmemonly = !global_memory;
+      func->norecurse = !recursive;
+      func->willreturn = returns;
+    }
+  }
+}
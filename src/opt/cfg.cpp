@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cassert>
+#include <unordered_set>
+#include "ir.h"
+
+using namespace std;
+
+void BuildCFG(Function &func) {
+  for (auto bb : func.blocks) {
+    bb->preds.clear();
+    bb->succs.clear();
+  }
+  for (auto bb : func.blocks) {
+    for (auto succ : bb->Terminator()->blocks) {
+      if (find(bb->succs.begin(), bb->succs.end(), succ) != bb->succs.end()) continue;
+      bb->succs.push_back(succ);
+      succ->preds.push_back(bb);
+    }
+  }
+}
+
+bool RemoveUnreachableBlocks(Function &func) {
+  unordered_set<BasicBlock *> reachable = {func.Entry()};
+  vector<BasicBlock *> work = {func.Entry()};
+  while (!work.empty()) {
+    auto bb = work.back();
+    work.pop_back();
+    for (auto succ : bb->Terminator()->blocks) {
+      if (reachable.insert(succ).second) work.push_back(succ);
+    }
+  }
+  bool changed = reachable.size() != func.blocks.size();
+  if (changed) {
+    for (auto bb : func.blocks) {
+      if (reachable.count(bb)) continue;
+      for (auto succ : bb->Terminator()->blocks) {
+        if (reachable.count(succ)) RemovePhiIncoming(succ, bb);
+      }
+    }
+    func.blocks.erase(remove_if(func.blocks.begin(), func.blocks.end(),
+                                [&](BasicBlock *bb) { return !reachable.count(bb); }),
+                      func.blocks.end());
+  }
+  BuildCFG(func);
+  return changed;
+}
+
+void ReplaceUses(Function &func, const unordered_map<Value *, Value *> &map) {
+  if (map.empty()) return;
+  auto resolve = [&](Value *value) {
+    for (auto it = map.find(value); it != map.end(); it = map.find(value)) {
+      value = it->second;
+    }
+    return value;
+  };
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      for (auto &operand : inst->operands) operand = resolve(operand);
+    }
+  }
+}
+
+Value *PhiIncoming(Value *phi, BasicBlock *pred) {
+  for (size_t i = 0; i < phi->blocks.size(); ++i) {
+    if (phi->blocks[i] == pred) return phi->operands[i];
+  }
+  return nullptr;
+}
+
+void RemovePhiIncoming(BasicBlock *bb, BasicBlock *pred) {
+  for (auto inst : bb->insts) {
+    if (inst->op != Op::PHI) break;
+    for (size_t i = 0; i < inst->blocks.size();) {
+      if (inst->blocks[i] == pred) {
+        inst->blocks.erase(inst->blocks.begin() + i);
+        inst->operands.erase(inst->operands.begin() + i);
+      } else {
+        ++i;
+      }
+    }
+  }
+}
+
+bool HasSideEffects(const Value *inst) {
+  switch (inst->op) {
+    case Op::CALL:
+      // Dropping a call that never returns would let the program go on.
+      return !inst->callee->readonly || !inst->callee->willreturn;
+    case Op::STORE:
+    case Op::BRANCH:
+    case Op::JUMP:
+    case Op::RETURN:
+      return true;
+    default:
+      return false;
+  }
+}
+
+Value *LocalRoot(Value *ptr) {
+  while (ptr->op == Op::GET_PTR || ptr->op == Op::GET_ELEM_PTR) ptr = ptr->operands[0];
+  return ptr->op == Op::ALLOC ? ptr : nullptr;
+}
+
+const vector<BasicBlock *> &DominatorTree::Preds(BasicBlock *bb) const {
+  if (!post) return bb->preds;
+  return bb ? bb->succs : exit_preds;
+}
+
+DominatorTree::DominatorTree(Function &func, bool post) : post(post) {
+  // In the post-dominator tree the edges are reversed: the virtual exit is the
+  // root and every returning block hangs off it.
+  vector<BasicBlock *> returns;
+  for (auto bb : func.blocks) {
+    if (bb->Terminator()->op == Op::RETURN) returns.push_back(bb);
+  }
+  auto succs = [&](BasicBlock *bb) -> const vector<BasicBlock *> & {
+    if (!post) return bb->succs;
+    return bb ? bb->preds : returns;
+  };
+  if (post) {
+    exit_preds = returns;
+  }
+  BasicBlock *root = post ? nullptr : func.Entry();
+
+  vector<BasicBlock *> postorder;
+  vector<pair<BasicBlock *, size_t>> stack = {{root, 0}};
+  unordered_set<BasicBlock *> visited = {root};
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    const auto &next = succs(top.first);
+    if (top.second < next.size()) {
+      auto succ = next[top.second++];
+      if (visited.insert(succ).second) stack.push_back({succ, 0});
+    } else {
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  order.assign(postorder.rbegin(), postorder.rend());
+  for (size_t i = 0; i < order.size(); ++i) index[order[i]] = (int)i;
+
+  auto preds = [&](BasicBlock *bb) {
+    vector<int> result;
+    if (post && bb && bb->Terminator()->op == Op::RETURN) result.push_back(index.at(nullptr));
+    for (auto pred : Preds(bb)) {
+      auto it = index.find(pred);
+      if (it != index.end()) result.push_back(it->second);
+    }
+    return result;
+  };
+  int n = (int)order.size();
+  idom.assign(n, -1);
+  idom[0] = 0;
+  auto intersect = [&](int a, int b) {
+    while (a != b) {
+      while (a > b) a = idom[a];
+      while (b > a) b = idom[b];
+    }
+    return a;
+  };
+  vector<vector<int>> pred_index(n);
+  for (int i = 1; i < n; ++i) pred_index[i] = preds(order[i]);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int i = 1; i < n; ++i) {
+      int new_idom = -1;
+      for (int pred : pred_index[i]) {
+        if (idom[pred] < 0) continue;
+        new_idom = new_idom < 0 ? pred : intersect(pred, new_idom);
+      }
+      if (new_idom != idom[i]) {
+        idom[i] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  children.assign(n, {});
+  depth.assign(n, 0);
+  for (int i = 1; i < n; ++i) {
+    children[idom[i]].push_back(order[i]);
+    depth[i] = depth[idom[i]] + 1;
+  }
+}
+
+BasicBlock *DominatorTree::IDom(BasicBlock *bb) const {
+  int i = index.at(bb);
+  return i == 0 ? nullptr : order[idom[i]];
+}
+
+bool DominatorTree::Dominates(BasicBlock *a, BasicBlock *b) const {
+  auto ia = index.find(a), ib = index.find(b);
+  if (ia == index.end() || ib == index.end()) return false;
+  int x = ib->second;
+  while (depth[x] > depth[ia->second]) x = idom[x];
+  return x == ia->second;
+}
+
+const vector<BasicBlock *> &DominatorTree::Children(BasicBlock *bb) const {
+  return children[index.at(bb)];
+}
+
+unordered_map<BasicBlock *, vector<BasicBlock *>> DominatorTree::Frontiers() const {
+  unordered_map<BasicBlock *, vector<BasicBlock *>> frontiers;
+  for (size_t i = 0; i < order.size(); ++i) {
+    auto bb = order[i];
+    vector<BasicBlock *> preds;
+    if (post && bb && bb->Terminator()->op == Op::RETURN) preds.push_back(nullptr);
+    for (auto pred : Preds(bb)) {
+      if (index.count(pred)) preds.push_back(pred);
+    }
+    if (preds.size() < 2) continue;
+    for (auto pred : preds) {
+      for (int runner = index.at(pred); runner != idom[i]; runner = idom[runner]) {
+        auto &frontier = frontiers[order[runner]];
+        if (frontier.empty() || frontier.back() != bb) frontier.push_back(bb);
+      }
+    }
+  }
+  return frontiers;
+}
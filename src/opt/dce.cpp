@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <unordered_set>
+#include "passes.h"
+
+using namespace std;
+
+bool EliminateDeadCode(Function &func) {
+  unordered_map<Value *, int> uses;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      for (auto operand : inst->operands) ++uses[operand];
+    }
+  }
+  vector<Value *> work;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (!HasSideEffects(inst) && !uses[inst]) work.push_back(inst);
+    }
+  }
+  unordered_set<Value *> dead;
+  while (!work.empty()) {
+    auto inst = work.back();
+    work.pop_back();
+    if (!dead.insert(inst).second) continue;
+    for (auto operand : inst->operands) {
+      if (--uses[operand] == 0 && operand->parent && !HasSideEffects(operand)) work.push_back(operand);
+    }
+  }
+  if (dead.empty()) return false;
+  for (auto bb : func.blocks) {
+    vector<Value *> kept;
+    for (auto inst : bb->insts) {
+      if (!dead.count(inst)) kept.push_back(inst);
+    }
+    bb->insts.swap(kept);
+  }
+  return true;
+}
+
+// Whether the contents of the local alloc can be observed: some address
+// derived from it is loaded from, passed to a call or otherwise escapes.
+static unordered_set<Value *> ObservedAllocs(Function &func) {
+  unordered_set<Value *> observed;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      for (size_t i = 0; i < inst->operands.size(); ++i) {
+        auto root = LocalRoot(inst->operands[i]);
+        if (!root) continue;
+        bool address_only = (inst->op == Op::STORE && i == 1) ||
+                            ((inst->op == Op::GET_PTR || inst->op == Op::GET_ELEM_PTR) && i == 0);
+        if (!address_only) observed.insert(root);
+      }
+    }
+  }
+  return observed;
+}
+
+bool AggressiveDCE(Module &module, Function &func) {
+  RemoveUnreachableBlocks(func);
+  DominatorTree pdom(func, true);
+  auto control_deps = pdom.Frontiers();
+  auto observed = ObservedAllocs(func);
+
+  unordered_set<Value *> live;
+  unordered_set<BasicBlock *> live_blocks;
+  vector<Value *> work;
+  auto mark = [&](Value *inst) {
+    if (inst->parent && live.insert(inst).second) work.push_back(inst);
+  };
+  for (auto bb : func.blocks) {
+    auto term = bb->Terminator();
+    // Branches we could not retarget: in blocks that never reach a return or
+    // may lead to one that does not, as skipping it would end a program that
+    // runs forever, or whose nearest post-dominator would need a new phi
+    // operand.
+    if (term->op == Op::BRANCH) {
+      auto target = pdom.Reachable(bb) ? pdom.IDom(bb) : nullptr;
+      bool endless = any_of(bb->succs.begin(), bb->succs.end(), [&](BasicBlock *succ) { return !pdom.Reachable(succ); });
+      bool retargetable = target && !endless && (target->insts[0]->op != Op::PHI ||
+                                     find(target->preds.begin(), target->preds.end(), bb) != target->preds.end());
+      if (!retargetable) mark(term);
+    }
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::RETURN || (inst->op == Op::CALL && HasSideEffects(inst))) {
+        mark(inst);
+      } else if (inst->op == Op::STORE) {
+        auto root = LocalRoot(inst->operands[1]);
+        if (!root || observed.count(root)) mark(inst);
+      }
+    }
+  }
+  while (!work.empty()) {
+    auto inst = work.back();
+    work.pop_back();
+    for (auto operand : inst->operands) mark(operand);
+    if (inst->op == Op::PHI) {
+      // The value depends on which edge control arrives by: keep the edges
+      // and whatever decides to reach their sources. A branch that would be
+      // retargeted to this very block keeps its edge anyway, and its own
+      // decision only repeats the predecessor, as in a loop whose exit feeds
+      // the phi a value computed outside of it.
+      for (auto pred : inst->blocks) {
+        bool kept_edge = pred->Terminator()->op == Op::JUMP ||
+                         (pdom.Reachable(pred) && pdom.IDom(pred) == inst->parent);
+        if (!kept_edge) mark(pred->Terminator());
+        for (auto dep : control_deps[pred]) {
+          if (dep && (dep != pred || !kept_edge)) mark(dep->Terminator());
+        }
+      }
+    }
+    auto bb = inst->parent;
+    if (!live_blocks.insert(bb).second) continue;
+    for (auto dep : control_deps[bb]) {
+      if (dep) mark(dep->Terminator());
+    }
+  }
+
+  bool changed = false;
+  for (auto bb : func.blocks) {
+    vector<Value *> kept;
+    for (auto inst : bb->insts) {
+      // Jumps only matter through the control dependences of the blocks they
+      // lead to, so they are kept without being marked.
+      if (live.count(inst) || inst->op == Op::JUMP) {
+        kept.push_back(inst);
+      } else if (inst->op == Op::BRANCH) {
+        // Nothing live depends on the direction taken: go straight to the
+        // nearest post-dominator, skipping the dead region in between.
+        auto target = pdom.IDom(bb);
+        for (auto succ : bb->succs) {
+          if (succ != target) RemovePhiIncoming(succ, bb);
+        }
+        auto jump = module.NewJump(target);
+        jump->parent = bb;
+        kept.push_back(jump);
+        changed = true;
+      } else {
+        changed = true;
+      }
+    }
+    bb->insts.swap(kept);
+  }
+  if (changed) RemoveUnreachableBlocks(func);
+  return changed;
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <functional>
+#include <set>
+#include "passes.h"
+
+using namespace std;
+
+bool EliminateDeadArguments(Module &module) {
+  // Only real uses count, not those left over by earlier rewrites.
+  for (auto func : module.functions) {
+    if (!func->IsDeclaration()) EliminateDeadCode(*func);
+  }
+  unordered_map<Value *, vector<Value *>> users;
+  vector<Value *> calls;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        for (auto operand : inst->operands) users[operand].push_back(inst);
+        if (inst->op == Op::CALL) calls.push_back(inst);
+      }
+    }
+  }
+
+  // Parameters and results are dead until a use proves otherwise. Passing a
+  // value on as a dead parameter or returning it as a dead result does not,
+  // nor does computing something from it that is only used that way, so a
+  // parameter a recursive function only hands to itself stays dead.
+  set<pair<Function *, int>> dead_args;
+  unordered_set<Function *> dead_results;
+  for (auto func : module.functions) {
+    if (func->IsDeclaration() || func->name == "main") continue;
+    for (size_t i = 0; i < func->args.size(); ++i) dead_args.insert({func, (int)i});
+    if (func->ret_ty != Type::Unit()) dead_results.insert(func);
+  }
+  // Whether values are live, as far as the dead sets of the current round
+  // tell. Those only shrink, so a stale answer just takes another round.
+  unordered_map<Value *, bool> known;
+  function<bool(Value *)> live;
+  auto dead_use = [&](Value *user, Value *value) {
+    if (user->op == Op::BINARY || user->op == Op::GET_PTR || user->op == Op::GET_ELEM_PTR) return !live(user);
+    if (user->op == Op::RETURN) return dead_results.count(user->parent->parent) != 0;
+    if (user->op != Op::CALL) return false;
+    for (size_t i = 0; i < user->operands.size(); ++i) {
+      if (user->operands[i] == value && !dead_args.count({user->callee, (int)i})) return false;
+    }
+    return true;
+  };
+  live = [&](Value *value) {
+    auto cached = known.find(value);
+    if (cached != known.end()) return cached->second;
+    auto it = users.find(value);
+    bool result = it != users.end() &&
+                  !all_of(it->second.begin(), it->second.end(), [&](Value *user) { return dead_use(user, value); });
+    return known[value] = result;
+  };
+  for (bool again = true; again;) {
+    again = false;
+    known.clear();
+    for (auto it = dead_args.begin(); it != dead_args.end();) {
+      if (live(it->first->args[it->second])) {
+        it = dead_args.erase(it);
+        again = true;
+      } else {
+        ++it;
+      }
+    }
+    for (auto call : calls) {
+      if (dead_results.count(call->callee) && live(call)) {
+        dead_results.erase(call->callee);
+        again = true;
+      }
+    }
+  }
+  if (dead_args.empty() && dead_results.empty()) return false;
+
+  // Every use of what is dropped goes away along with it.
+  for (auto call : calls) {
+    auto callee = call->callee;
+    vector<Value *> operands;
+    for (size_t i = 0; i < call->operands.size(); ++i) {
+      if (!dead_args.count({callee, (int)i})) operands.push_back(call->operands[i]);
+    }
+    call->operands.swap(operands);
+    if (dead_results.count(callee)) call->ty = Type::Unit();
+  }
+  for (auto func : module.functions) {
+    vector<Value *> args;
+    for (auto arg : func->args) {
+      if (dead_args.count({func, arg->imm})) continue;
+      arg->imm = (int)args.size();
+      args.push_back(arg);
+    }
+    func->args.swap(args);
+    if (!dead_results.count(func)) continue;
+    func->ret_ty = Type::Unit();
+    for (auto bb : func->blocks) {
+      if (bb->Terminator()->op == Op::RETURN) bb->Terminator()->operands.clear();
+    }
+  }
+  return true;
+}
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include "passes.h"
+
+using namespace std;
+
+static bool IsScalarGlobal(Value *value) {
+  return value->op == Op::GLOBAL && value->ty->base == Type::Int32();
+}
+
+// Whether every access to global within loop goes to it directly and no
+// call in there touches it, so that a local can stand in for it while the
+// loop runs. Only globals the loop writes are worth it.
+static bool CanPromote(const Loop &loop, Value *global, const unordered_set<Value *> &escaped) {
+  bool stored = false;
+  for (auto bb : loop.blocks) {
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::LOAD || inst->op == Op::STORE) {
+        auto ptr = inst->operands[inst->op == Op::LOAD ? 0 : 1];
+        if (ptr == global) {
+          stored |= inst->op == Op::STORE;
+        } else if (MayAlias(ptr, global)) {
+          return false;
+        }
+      } else if (inst->op == Op::CALL && CallMayAccess(inst, global, escaped)) {
+        return false;
+      }
+    }
+  }
+  return stored;
+}
+
+// Loads global into a new local in the preheader of loop, makes the loop use
+// the local instead, and stores it back on every edge leaving the loop.
+static void Promote(Module &module, Function &func, const Loop &loop, Value *global) {
+  auto local = module.NewValue(Op::ALLOC, global->ty);
+  local->name = global->name;
+  local->parent = func.Entry();
+  func.Entry()->insts.insert(func.Entry()->insts.begin(), local);
+  auto preheader = loop.Preheader();
+  auto value = module.NewLoad(global);
+  preheader->InsertBeforeTerminator(value);
+  preheader->InsertBeforeTerminator(module.NewStore(value, local));
+  for (auto bb : loop.blocks) {
+    for (auto inst : bb->insts) {
+      if ((inst->op == Op::LOAD || inst->op == Op::STORE) && inst->operands.back() == global) {
+        inst->operands.back() = local;
+      }
+    }
+  }
+  for (auto bb : loop.ExitingBlocks()) {
+    auto succs = bb->succs;
+    for (auto succ : succs) {
+      if (loop.Contains(succ)) continue;
+      auto exit = module.NewBlock(&func, bb->name + "_exit");
+      auto add = [&](Value *inst) {
+        inst->parent = exit;
+        exit->insts.push_back(inst);
+        return inst;
+      };
+      add(module.NewStore(add(module.NewLoad(local)), global));
+      add(module.NewJump(succ));
+      for (auto &target : bb->Terminator()->blocks) {
+        if (target == succ) target = exit;
+      }
+      for (auto phi : succ->insts) {
+        if (phi->op != Op::PHI) break;
+        for (auto &block : phi->blocks) {
+          if (block == bb) block = exit;
+        }
+      }
+      func.blocks.push_back(exit);
+    }
+  }
+}
+
+bool PromoteGlobals(Module &module, Function &func) {
+  bool changed = false;
+  // Each promotion splits edges, so the loops are found anew after it. The
+  // outer loops go first, where the value stays in a register longest.
+  for (bool again = true; again;) {
+    again = false;
+    InsertPreheaders(module, func);
+    DominatorTree dom(func);
+    LoopInfo loops(func, dom);
+    auto escaped = EscapedAllocs(func);
+    const auto &order = loops.Loops();
+    for (auto it = order.rbegin(); !again && it != order.rend(); ++it) {
+      auto loop = *it;
+      if (!loop->Preheader()) continue;
+      for (auto global : module.globals) {
+        if (!IsScalarGlobal(global) || !CanPromote(*loop, global, escaped)) continue;
+        Promote(module, func, *loop, global);
+        BuildCFG(func);
+        again = changed = true;
+        break;
+      }
+    }
+  }
+  if (changed) PromoteAllocs(module, func);
+  return changed;
+}
+
+bool LocalizeGlobals(Module &module) {
+  auto main = module.FindFunction("main");
+  if (!main || main->IsDeclaration() || !main->norecurse) return false;
+  // Scalars only main loads and stores, and does nothing else with, behave
+  // just like its locals.
+  unordered_set<Value *> foreign;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        for (size_t i = 0; i < inst->operands.size(); ++i) {
+          auto operand = inst->operands[i];
+          if (operand->op != Op::GLOBAL) continue;
+          bool plain = (inst->op == Op::LOAD && i == 0) || (inst->op == Op::STORE && i == 1);
+          if (func != main || !plain) foreign.insert(operand);
+        }
+      }
+    }
+  }
+  unordered_map<Value *, Value *> locals;
+  auto entry = main->Entry();
+  vector<Value *> prologue;
+  for (auto global : module.globals) {
+    if (!IsScalarGlobal(global) || foreign.count(global)) continue;
+    auto local = module.NewValue(Op::ALLOC, global->ty);
+    local->name = global->name;
+    local->parent = entry;
+    auto init = module.NewStore(module.Const(global->init.empty() ? 0 : global->init[0]), local);
+    init->parent = entry;
+    prologue.push_back(local);
+    prologue.push_back(init);
+    locals[global] = local;
+  }
+  if (locals.empty()) return false;
+  entry->insts.insert(entry->insts.begin(), prologue.begin(), prologue.end());
+  ReplaceUses(*main, locals);
+  module.globals.erase(remove_if(module.globals.begin(), module.globals.end(),
+                                 [&](Value *global) { return locals.count(global); }),
+                       module.globals.end());
+  PromoteAllocs(module, *main);
+  return true;
+}
+
+// Whether the memory at addr, an address into a global, may be written: it
+// is stored to, passed to a call that may write memory, or used in any way
+// other than to load or compute another such address.
+static bool MayBeWritten(Value *addr, const unordered_map<Value *, vector<Value *>> &users) {
+  auto it = users.find(addr);
+  if (it == users.end()) return false;
+  for (auto user : it->second) {
+    switch (user->op) {
+      case Op::LOAD:
+        break;
+      case Op::GET_PTR:
+      case Op::GET_ELEM_PTR:
+        if (user->operands[0] != addr || MayBeWritten(user, users)) return true;
+        break;
+      case Op::CALL:
+        if (!user->callee->readonly) return true;
+        break;
+      default:
+        return true;
+    }
+  }
+  return false;
+}
+
+bool FoldConstantGlobals(Module &module) {
+  unordered_map<Value *, vector<Value *>> users;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        for (auto operand : inst->operands) users[operand].push_back(inst);
+      }
+    }
+  }
+  bool changed = false;
+  for (auto global : module.globals) {
+    global->constant = !MayBeWritten(global, users);
+    changed |= global->constant;
+  }
+  if (!changed) return false;
+
+  for (auto func : module.functions) {
+    unordered_map<Value *, Value *> loaded;
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        if (inst->op != Op::LOAD) continue;
+        if (auto value = LoadedConstant(module, inst->operands[0])) loaded[inst] = value;
+      }
+    }
+    if (loaded.empty()) continue;
+    ReplaceUses(*func, loaded);
+    EliminateDeadCode(*func);
+  }
+  // Those now read nowhere need no storage at all.
+  unordered_set<Value *> used;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) used.insert(inst->operands.begin(), inst->operands.end());
+    }
+  }
+  module.globals.erase(remove_if(module.globals.begin(), module.globals.end(),
+                                 [&](Value *global) { return global->constant && !used.count(global); }),
+                       module.globals.end());
+  return true;
+}
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <tuple>
+#include "passes.h"
+
+using namespace std;
+
+using Key = tuple<Op, BinOp, Value *, Value *>;
+// Calls of readonly functions by callee and arguments, with the memory state
+// they ran in, or 0 for pure functions, whose result ignores memory.
+using CallKey = tuple<Function *, vector<Value *>, int>;
+
+static bool IsCommutative(BinOp op) {
+  return op == BinOp::ADD || op == BinOp::MUL || op == BinOp::EQ || op == BinOp::NOT_EQ || op == BinOp::AND ||
+         op == BinOp::OR;
+}
+
+// The key under which inst is numbered: equal keys compute equal values.
+static Key KeyOf(Value *inst) {
+  auto lhs = inst->operands[0], rhs = inst->operands[1];
+  auto op = inst->binop;
+  if (inst->op == Op::BINARY) {
+    if (op == BinOp::GT || op == BinOp::GE) {
+      op = op == BinOp::GT ? BinOp::LT : BinOp::LE;
+      swap(lhs, rhs);
+    } else if (IsCommutative(op) && less<Value *>()(rhs, lhs)) {
+      swap(lhs, rhs);
+    }
+  } else {
+    op = BinOp::ADD;
+  }
+  return Key(inst->op, op, lhs, rhs);
+}
+
+// Constant folding, loads of constant globals and algebraic identities.
+// Returns the value inst computes if it is a constant or one of its operands,
+// and null otherwise.
+static Value *Simplify(Module &module, Value *inst) {
+  if (inst->op == Op::LOAD) return LoadedConstant(module, inst->operands[0]);
+  if (inst->op == Op::GET_PTR) {
+    auto index = inst->operands[1];
+    return index->IsConst() && index->imm == 0 ? inst->operands[0] : nullptr;
+  }
+  if (inst->op != Op::BINARY) return nullptr;
+  auto lhs = inst->operands[0], rhs = inst->operands[1];
+  int result;
+  if (lhs->IsConst() && rhs->IsConst()) {
+    return EvalBinary(inst->binop, lhs->imm, rhs->imm, &result) ? module.Const(result) : nullptr;
+  }
+  auto is = [](Value *value, int imm) { return value->IsConst() && value->imm == imm; };
+  switch (inst->binop) {
+    case BinOp::ADD:
+      if (is(rhs, 0)) return lhs;
+      if (is(lhs, 0)) return rhs;
+      break;
+    case BinOp::SUB:
+      if (is(rhs, 0)) return lhs;
+      if (lhs == rhs) return module.Const(0);
+      break;
+    case BinOp::MUL:
+      if (is(rhs, 1)) return lhs;
+      if (is(lhs, 1)) return rhs;
+      if (is(lhs, 0) || is(rhs, 0)) return module.Const(0);
+      break;
+    case BinOp::DIV:
+      if (is(rhs, 1)) return lhs;
+      break;
+    case BinOp::MOD:
+      if (is(rhs, 1) || is(rhs, -1)) return module.Const(0);
+      break;
+    case BinOp::EQ:
+    case BinOp::GE:
+    case BinOp::LE:
+      if (lhs == rhs && lhs->op != Op::UNDEF) return module.Const(1);
+      break;
+    case BinOp::NOT_EQ:
+    case BinOp::GT:
+    case BinOp::LT:
+      if (lhs == rhs && lhs->op != Op::UNDEF) return module.Const(0);
+      break;
+    default:
+      break;
+  }
+  return nullptr;
+}
+
+bool GlobalValueNumbering(Module &module, Function &func) {
+  RemoveUnreachableBlocks(func);
+  DominatorTree dom(func);
+  auto escaped = EscapedAllocs(func);
+
+  // Values computed in the dominators of the current block, by key.
+  map<Key, Value *> table;
+  map<CallKey, Value *> calls;
+  // Numbers the states of memory: a new one starts at every write.
+  int states = 0;
+  unordered_map<Value *, Value *> replace;
+  auto resolve = [&](Value *value) {
+    for (auto it = replace.find(value); it != replace.end(); it = replace.find(value)) value = it->second;
+    return value;
+  };
+  // memory holds the addresses whose contents are known on entry to bb, with
+  // the value they hold: loaded from or stored there, and not clobbered since.
+  using Memory = vector<pair<Value *, Value *>>;
+  function<void(BasicBlock *, Memory, int)> visit = [&](BasicBlock *bb, Memory memory, int state) {
+    // Other paths into a join may have written anything.
+    if (bb->preds.size() != 1) {
+      memory.clear();
+      state = ++states;
+    }
+    vector<Key> scope;
+    vector<CallKey> call_scope;
+    vector<Value *> kept;
+    for (auto inst : bb->insts) {
+      // Phi operands may come from blocks not visited yet; they are rewritten
+      // once everything is numbered.
+      if (inst->op != Op::PHI) {
+        for (auto &operand : inst->operands) operand = resolve(operand);
+      }
+      if (auto simple = Simplify(module, inst)) {
+        replace[inst] = simple;
+        continue;
+      }
+      if (inst->op == Op::BINARY || inst->op == Op::GET_PTR || inst->op == Op::GET_ELEM_PTR) {
+        auto key = KeyOf(inst);
+        auto it = table.find(key);
+        if (it != table.end()) {
+          replace[inst] = it->second;
+          continue;
+        }
+        table.emplace(key, inst);
+        scope.push_back(key);
+      } else if (inst->op == Op::LOAD) {
+        auto ptr = inst->operands[0];
+        auto it = find_if(memory.begin(), memory.end(), [&](const pair<Value *, Value *> &known) {
+          return known.first == ptr;
+        });
+        if (it != memory.end()) {
+          replace[inst] = it->second;
+          continue;
+        }
+        memory.emplace_back(ptr, inst);
+      } else if (inst->op == Op::STORE) {
+        auto ptr = inst->operands[1];
+        memory.erase(remove_if(memory.begin(), memory.end(),
+                               [&](const pair<Value *, Value *> &known) { return MayAlias(known.first, ptr); }),
+                     memory.end());
+        memory.emplace_back(ptr, inst->operands[0]);
+        auto root = LocalRoot(ptr);
+        if (!root || escaped.count(root)) state = ++states;
+      } else if (inst->op == Op::CALL && inst->callee->readonly) {
+        if (inst->HasResult()) {
+          CallKey key(inst->callee, inst->operands, inst->callee->pure ? 0 : state);
+          auto it = calls.find(key);
+          if (it != calls.end()) {
+            replace[inst] = it->second;
+            continue;
+          }
+          calls.emplace(key, inst);
+          call_scope.push_back(key);
+        }
+      } else if (inst->op == Op::CALL) {
+        state = ++states;
+        memory.erase(remove_if(memory.begin(), memory.end(),
+                               [&](const pair<Value *, Value *> &known) {
+                                 return CallMayClobber(inst, known.first, escaped);
+                               }),
+                     memory.end());
+      }
+      kept.push_back(inst);
+    }
+    bb->insts.swap(kept);
+    for (auto child : dom.Children(bb)) visit(child, memory, state);
+    for (auto &key : scope) table.erase(key);
+    for (auto &key : call_scope) calls.erase(key);
+  };
+  visit(func.Entry(), Memory(), ++states);
+  ReplaceUses(func, replace);
+  return !replace.empty();
+}
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include "passes.h"
+
+using namespace std;
+
+// A callee is inlined when its size in instructions stays within a threshold
+// that grows with the loop depth of the call, as a stand-in for how often it
+// runs, and with every constant argument, which lets the copy fold further.
+static const int kInlineThreshold = 24;
+static const int kLoopDepthBonus = 16;
+static const int kMaxLoopDepthBonus = 3;
+static const int kConstArgBonus = 4;
+// Inlining the only call of a function removes the function, so only the
+// size of the caller limits it.
+static const int kSingleCallThreshold = 400;
+static const int kMaxCallerSize = 3000;
+
+static int Size(const Function &func) {
+  int size = 0;
+  for (auto bb : func.blocks) size += (int)bb->insts.size();
+  return size;
+}
+
+// Replaces call with a copy of the body of its callee: the block holding the
+// call jumps to the copied entry, and every copied return jumps to a new block
+// holding the instructions that followed the call.
+static void InlineCall(Module &module, Function &caller, Value *call) {
+  auto callee = call->callee;
+  auto bb = call->parent;
+  auto pos = find(bb->insts.begin(), bb->insts.end(), call);
+  auto cont = module.NewBlock(&caller, bb->name);
+  for (auto it = pos + 1; it != bb->insts.end(); ++it) {
+    (*it)->parent = cont;
+    cont->insts.push_back(*it);
+  }
+  bb->insts.erase(pos, bb->insts.end());
+  for (auto succ : cont->Terminator()->blocks) {
+    for (auto phi : succ->insts) {
+      if (phi->op != Op::PHI) break;
+      replace(phi->blocks.begin(), phi->blocks.end(), bb, cont);
+    }
+  }
+
+  unordered_map<Value *, Value *> values;
+  unordered_map<BasicBlock *, BasicBlock *> blocks;
+  for (size_t i = 0; i < callee->args.size(); ++i) values[callee->args[i]] = call->operands[i];
+  vector<BasicBlock *> copies;
+  for (auto callee_bb : callee->blocks) {
+    auto copy = module.NewBlock(&caller, callee->name + "_" + callee_bb->name);
+    blocks[callee_bb] = copy;
+    copies.push_back(copy);
+    for (auto inst : callee_bb->insts) {
+      auto inst_copy = module.NewValue(inst->op, inst->ty);
+      *inst_copy = *inst;
+      inst_copy->parent = copy;
+      copy->insts.push_back(inst_copy);
+      values[inst] = inst_copy;
+    }
+  }
+  auto entry = caller.Entry();
+  vector<Value *> allocs, results;
+  vector<BasicBlock *> returns;
+  for (auto copy : copies) {
+    vector<Value *> kept;
+    for (auto inst : copy->insts) {
+      for (auto &operand : inst->operands) {
+        auto it = values.find(operand);
+        if (it != values.end()) operand = it->second;
+      }
+      for (auto &target : inst->blocks) target = blocks.at(target);
+      if (inst->op == Op::ALLOC) {
+        // Locals of the callee become locals of the caller.
+        inst->parent = entry;
+        allocs.push_back(inst);
+        continue;
+      }
+      if (inst->op == Op::RETURN) {
+        if (!inst->operands.empty()) results.push_back(inst->operands[0]);
+        returns.push_back(copy);
+        auto jump = module.NewJump(cont);
+        jump->parent = copy;
+        kept.push_back(jump);
+        continue;
+      }
+      kept.push_back(inst);
+    }
+    copy->insts.swap(kept);
+  }
+  entry->insts.insert(entry->insts.begin(), allocs.begin(), allocs.end());
+  auto jump = module.NewJump(blocks.at(callee->Entry()));
+  jump->parent = bb;
+  bb->insts.push_back(jump);
+
+  auto at = find(caller.blocks.begin(), caller.blocks.end(), bb) + 1;
+  at = caller.blocks.insert(at, copies.begin(), copies.end()) + copies.size();
+  caller.blocks.insert(at, cont);
+
+  if (call->HasResult()) {
+    Value *result = module.Undef();
+    if (results.size() == 1) {
+      result = results[0];
+    } else if (!results.empty()) {
+      result = module.NewPhi(call->ty);
+      result->operands = results;
+      result->blocks = returns;
+      result->parent = cont;
+      cont->insts.insert(cont->insts.begin(), result);
+    }
+    ReplaceUses(caller, {{call, result}});
+  }
+}
+
+bool InlineFunctions(Module &module) {
+  auto sccs = CallGraphSCCs(module);
+  unordered_map<Function *, size_t> scc_of;
+  for (size_t i = 0; i < sccs.size(); ++i) {
+    for (auto func : sccs[i]) scc_of[func] = i;
+  }
+  unordered_map<Function *, int> call_sites;
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        if (inst->op == Op::CALL) ++call_sites[inst->callee];
+      }
+    }
+  }
+
+  // Callees come first, so what gets copied has already been inlined into.
+  // Calls within a component are left alone, which keeps recursion finite.
+  bool changed = false;
+  for (const auto &scc : sccs) {
+    for (auto caller : scc) {
+      RemoveUnreachableBlocks(*caller);
+      DominatorTree dom(*caller);
+      LoopInfo loops(*caller, dom);
+      vector<pair<Value *, int>> sites;
+      for (auto bb : caller->blocks) {
+        auto loop = loops.LoopFor(bb);
+        for (auto inst : bb->insts) {
+          if (inst->op != Op::CALL || inst->callee->IsDeclaration() || scc_of[inst->callee] == scc_of[caller]) continue;
+          sites.emplace_back(inst, loop ? loop->depth : 0);
+        }
+      }
+      int size = Size(*caller);
+      bool inlined = false;
+      for (const auto &site : sites) {
+        auto call = site.first;
+        auto callee = call->callee;
+        int callee_size = Size(*callee);
+        int threshold = kInlineThreshold + kLoopDepthBonus * min(site.second, kMaxLoopDepthBonus);
+        for (auto arg : call->operands) threshold += arg->IsConst() ? kConstArgBonus : 0;
+        if (call_sites[callee] == 1 && callee->name != "main") threshold = max(threshold, kSingleCallThreshold);
+        if (callee_size > threshold || size + callee_size > kMaxCallerSize) continue;
+        for (auto bb : callee->blocks) {
+          for (auto inst : bb->insts) {
+            if (inst->op == Op::CALL) ++call_sites[inst->callee];
+          }
+        }
+        --call_sites[callee];
+        InlineCall(module, *caller, call);
+        size += callee_size;
+        inlined = true;
+      }
+      if (inlined) {
+        RemoveUnreachableBlocks(*caller);
+        changed = true;
+      }
+    }
+  }
+
+  return RemoveUncalledFunctions(module) || changed;
+}
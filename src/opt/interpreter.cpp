@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include "passes.h"
+
+using namespace std;
+
+// Bounds on the work done evaluating one call: instructions executed,
+// words of locals allocated, and depth of nested calls.
+static const long long kMaxSteps = 1 << 20;
+// Bound on the instructions executed evaluating all calls of a module.
+static const long long kMaxModuleSteps = 1 << 23;
+static const long long kMaxWords = 1 << 20;
+static const int kMaxDepth = 1000;
+
+namespace {
+
+// A value computed by the interpreter: an integer, or an address given as a
+// byte offset into one of the objects allocated so far.
+struct Cell {
+  int value = 0;
+  int object = -1;
+};
+
+// Runs pure functions on constant arguments; the only globals they read are
+// constant. Evaluation fails, rather than guessing, on anything the generated
+// code would trap on, on memory accesses outside their object and once a
+// bound is exceeded.
+class Interpreter {
+public:
+  // Evaluates a call of func on integer arguments, within fresh bounds.
+  bool Evaluate(Function *func, const vector<int> &args, int *result);
+  // Whether the steps allowed for the whole module are used up.
+  bool Exhausted() const { return budget <= 0; }
+
+private:
+  bool Call(Function *func, const vector<Cell> &args, Cell *result);
+  bool Run(Function *func, const vector<Cell> &args, Cell *result);
+  bool Access(const Cell &ptr, int **word);
+  bool Global(Value *global, Cell *cell);
+
+  long long steps = 0, words = 0, max_steps = 0;
+  long long budget = kMaxModuleSteps;
+  int depth = 0;
+  vector<vector<int>> objects;
+  // The objects holding the constant globals read so far.
+  unordered_map<Value *, int> globals;
+  // Results of the calls evaluated so far by function and arguments.
+  map<pair<Function *, vector<int>>, int> results;
+  // Calls that failed even with fresh bounds, so they fail with any.
+  set<pair<Function *, vector<int>>> failures;
+};
+
+}  // namespace
+
+bool Interpreter::Access(const Cell &ptr, int **word) {
+  if (ptr.object < 0 || ptr.value < 0 || ptr.value % 4) return false;
+  auto &object = objects[ptr.object];
+  if ((size_t)ptr.value / 4 >= object.size()) return false;
+  *word = &object[ptr.value / 4];
+  return true;
+}
+
+bool Interpreter::Global(Value *global, Cell *cell) {
+  if (!global->constant) return false;
+  auto it = globals.find(global);
+  if (it == globals.end()) {
+    int size = global->ty->base->Size();
+    words += size / 4;
+    if (words > kMaxWords) return false;
+    it = globals.emplace(global, (int)objects.size()).first;
+    objects.emplace_back(size / 4, 0);
+    copy(global->init.begin(), global->init.end(), objects.back().begin());
+  }
+  *cell = Cell{0, it->second};
+  return true;
+}
+
+bool Interpreter::Evaluate(Function *func, const vector<int> &args, int *result) {
+  if (Exhausted() || failures.count({func, args})) return false;
+  steps = words = 0;
+  max_steps = min(kMaxSteps, budget);
+  depth = 0;
+  objects.clear();
+  globals.clear();
+  vector<Cell> cells;
+  for (int arg : args) cells.push_back(Cell{arg, -1});
+  Cell cell;
+  bool ok = Call(func, cells, &cell) && cell.object < 0;
+  budget -= steps;
+  if (!ok) {
+    failures.insert({func, args});
+    return false;
+  }
+  *result = cell.value;
+  return true;
+}
+
+bool Interpreter::Call(Function *func, const vector<Cell> &args, Cell *result) {
+  // Only calls on plain integers are remembered, and so only their results.
+  vector<int> key;
+  for (const auto &arg : args) {
+    if (arg.object >= 0) return Run(func, args, result);
+    key.push_back(arg.value);
+  }
+  auto it = results.find({func, key});
+  if (it != results.end()) {
+    *result = Cell{it->second, -1};
+    return true;
+  }
+  if (failures.count({func, key}) || !Run(func, args, result)) return false;
+  if (result->object < 0) results[{func, key}] = result->value;
+  return true;
+}
+
+bool Interpreter::Run(Function *func, const vector<Cell> &args, Cell *result) {
+  if (func->IsDeclaration() || ++depth > kMaxDepth) return false;
+  unordered_map<Value *, Cell> values;
+  for (size_t i = 0; i < args.size(); ++i) values[func->args[i]] = args[i];
+  auto get = [&](Value *value, Cell *cell) {
+    if (value->op == Op::INTEGER) {
+      *cell = Cell{value->imm, -1};
+      return true;
+    }
+    if (value->op == Op::GLOBAL) return Global(value, cell);
+    auto it = values.find(value);
+    if (it == values.end()) return false;
+    *cell = it->second;
+    return true;
+  };
+
+  BasicBlock *bb = func->Entry(), *pred = nullptr;
+  while (true) {
+    // Phis read their operands together, before any of them is updated.
+    vector<pair<Value *, Cell>> incoming;
+    for (auto phi : bb->insts) {
+      if (phi->op != Op::PHI) break;
+      auto value = PhiIncoming(phi, pred);
+      Cell cell;
+      if (!value || !get(value, &cell)) return false;
+      incoming.emplace_back(phi, cell);
+    }
+    for (const auto &phi : incoming) values[phi.first] = phi.second;
+
+    BasicBlock *next = nullptr;
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::PHI) continue;
+      if (++steps > max_steps) return false;
+      vector<Cell> operands(inst->operands.size());
+      for (size_t i = 0; i < operands.size(); ++i) {
+        if (!get(inst->operands[i], &operands[i])) return false;
+      }
+      Cell cell;
+      int *word;
+      switch (inst->op) {
+        case Op::ALLOC: {
+          int size = inst->ty->base->Size();
+          words += size / 4;
+          if (words > kMaxWords) return false;
+          cell.object = (int)objects.size();
+          objects.emplace_back(size / 4, 0);
+          break;
+        }
+        case Op::LOAD:
+          if (!Access(operands[0], &word)) return false;
+          cell.value = *word;
+          break;
+        case Op::STORE:
+          if (operands[0].object >= 0 || !Access(operands[1], &word)) return false;
+          *word = operands[0].value;
+          break;
+        case Op::GET_PTR:
+        case Op::GET_ELEM_PTR: {
+          auto elem = inst->op == Op::GET_PTR ? inst->operands[0]->ty->base : inst->operands[0]->ty->base->base;
+          if (operands[1].object >= 0) return false;
+          cell = operands[0];
+          cell.value = (int)((unsigned)cell.value + (unsigned)operands[1].value * (unsigned)elem->Size());
+          break;
+        }
+        case Op::BINARY:
+          if (operands[0].object >= 0 || operands[1].object >= 0) return false;
+          if (!EvalBinary(inst->binop, operands[0].value, operands[1].value, &cell.value)) return false;
+          break;
+        case Op::CALL:
+          if (!Call(inst->callee, operands, &cell)) return false;
+          break;
+        case Op::BRANCH:
+          if (operands[0].object >= 0) return false;
+          next = inst->blocks[operands[0].value ? 0 : 1];
+          break;
+        case Op::JUMP:
+          next = inst->blocks[0];
+          break;
+        case Op::RETURN:
+          if (!operands.empty()) *result = operands[0];
+          --depth;
+          return true;
+        default:
+          return false;
+      }
+      if (inst->HasResult()) values[inst] = cell;
+    }
+    pred = bb;
+    bb = next;
+  }
+}
+
+bool EvaluateConstantCalls(Module &module) {
+  Interpreter interpreter;
+  bool changed = false;
+  for (auto func : module.functions) {
+    unordered_map<Value *, Value *> results;
+    for (auto bb : func->blocks) {
+      vector<Value *> kept;
+      for (auto inst : bb->insts) {
+        bool constant = inst->op == Op::CALL && inst->callee->pure && !interpreter.Exhausted();
+        for (size_t i = 0; constant && i < inst->operands.size(); ++i) constant = inst->operands[i]->IsConst();
+        int result = 0;
+        vector<int> args;
+        if (constant) {
+          for (auto arg : inst->operands) args.push_back(arg->imm);
+        }
+        if (!constant || !interpreter.Evaluate(inst->callee, args, &result)) {
+          kept.push_back(inst);
+          continue;
+        }
+        if (inst->HasResult()) results[inst] = module.Const(result);
+        changed = true;
+      }
+      bb->insts.swap(kept);
+    }
+    if (!results.empty()) ReplaceUses(*func, results);
+  }
+  return changed;
+}
@@ -0,0 +1,207 @@
+#include <set>
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// What is known about a value: nothing yet, that it is always the same
+// constant, or that it varies.
+struct Lattice {
+  enum State { UNKNOWN, CONSTANT, VARYING } state = UNKNOWN;
+  int value = 0;
+
+  // Lowers this to its meet with other; returns whether it changed.
+  bool Meet(const Lattice &other) {
+    if (other.state == UNKNOWN || state == VARYING) return false;
+    if (state == UNKNOWN) {
+      *this = other;
+      return true;
+    }
+    if (other.state == CONSTANT && other.value == value) return false;
+    state = VARYING;
+    return true;
+  }
+};
+
+// Sparse conditional constant propagation over the whole module at once:
+// blocks are only considered once some executable edge reaches them,
+// functions once an executable call does, and arguments and call results
+// meet the values of every executable call and return.
+class Solver {
+public:
+  explicit Solver(Module &module);
+  void Solve(Function *main);
+  Lattice Get(Value *value) const;
+  bool Executable(BasicBlock *bb) const { return executable.count(bb) != 0; }
+
+private:
+  void Update(Value *value, const Lattice &lattice);
+  void MarkEdge(BasicBlock *from, BasicBlock *to);
+  void MarkBlock(BasicBlock *bb);
+  void Visit(Value *inst);
+
+  unordered_map<Value *, Lattice> values;
+  unordered_map<Function *, Lattice> returns;
+  unordered_map<Value *, vector<Value *>> users;
+  unordered_map<Function *, vector<Value *>> calls;
+  set<pair<BasicBlock *, BasicBlock *>> edges;
+  unordered_set<BasicBlock *> executable;
+  vector<BasicBlock *> block_work;
+  vector<Value *> value_work;
+};
+
+}  // namespace
+
+Solver::Solver(Module &module) {
+  for (auto func : module.functions) {
+    for (auto bb : func->blocks) {
+      for (auto inst : bb->insts) {
+        for (auto operand : inst->operands) users[operand].push_back(inst);
+        if (inst->op == Op::CALL) calls[inst->callee].push_back(inst);
+      }
+    }
+  }
+}
+
+Lattice Solver::Get(Value *value) const {
+  Lattice lattice;
+  if (value->IsConst()) {
+    lattice.state = Lattice::CONSTANT;
+    lattice.value = value->imm;
+  } else if (value->op == Op::UNDEF || value->op == Op::GLOBAL) {
+    lattice.state = Lattice::VARYING;
+  } else {
+    auto it = values.find(value);
+    if (it != values.end()) lattice = it->second;
+  }
+  return lattice;
+}
+
+void Solver::Update(Value *value, const Lattice &lattice) {
+  if (!values[value].Meet(lattice)) return;
+  auto it = users.find(value);
+  if (it != users.end()) value_work.insert(value_work.end(), it->second.begin(), it->second.end());
+}
+
+void Solver::MarkBlock(BasicBlock *bb) {
+  if (executable.insert(bb).second) block_work.push_back(bb);
+}
+
+void Solver::MarkEdge(BasicBlock *from, BasicBlock *to) {
+  if (!edges.insert({from, to}).second) return;
+  if (Executable(to)) {
+    // Only the phis see the new edge.
+    for (auto phi : to->insts) {
+      if (phi->op != Op::PHI) break;
+      value_work.push_back(phi);
+    }
+  } else {
+    MarkBlock(to);
+  }
+}
+
+void Solver::Visit(Value *inst) {
+  auto bb = inst->parent;
+  Lattice varying;
+  varying.state = Lattice::VARYING;
+  switch (inst->op) {
+    case Op::PHI: {
+      Lattice lattice;
+      for (size_t i = 0; i < inst->operands.size(); ++i) {
+        if (edges.count({inst->blocks[i], bb})) lattice.Meet(Get(inst->operands[i]));
+      }
+      Update(inst, lattice);
+      break;
+    }
+    case Op::BINARY: {
+      auto lhs = Get(inst->operands[0]), rhs = Get(inst->operands[1]);
+      if (lhs.state == Lattice::VARYING || rhs.state == Lattice::VARYING) {
+        Update(inst, varying);
+      } else if (lhs.state == Lattice::CONSTANT && rhs.state == Lattice::CONSTANT) {
+        Lattice lattice;
+        lattice.state = Lattice::CONSTANT;
+        if (!EvalBinary(inst->binop, lhs.value, rhs.value, &lattice.value)) lattice = varying;
+        Update(inst, lattice);
+      }
+      break;
+    }
+    case Op::CALL: {
+      auto callee = inst->callee;
+      if (callee->IsDeclaration()) {
+        if (inst->HasResult()) Update(inst, varying);
+        break;
+      }
+      for (size_t i = 0; i < inst->operands.size(); ++i) Update(callee->args[i], Get(inst->operands[i]));
+      MarkBlock(callee->Entry());
+      if (inst->HasResult()) Update(inst, returns[callee]);
+      break;
+    }
+    case Op::BRANCH: {
+      auto cond = Get(inst->operands[0]);
+      if (cond.state == Lattice::CONSTANT) {
+        MarkEdge(bb, inst->blocks[cond.value ? 0 : 1]);
+      } else if (cond.state == Lattice::VARYING) {
+        MarkEdge(bb, inst->blocks[0]);
+        MarkEdge(bb, inst->blocks[1]);
+      }
+      break;
+    }
+    case Op::JUMP:
+      MarkEdge(bb, inst->blocks[0]);
+      break;
+    case Op::RETURN: {
+      if (inst->operands.empty() || !returns[bb->parent].Meet(Get(inst->operands[0]))) break;
+      auto &sites = calls[bb->parent];
+      value_work.insert(value_work.end(), sites.begin(), sites.end());
+      break;
+    }
+    default:
+      if (inst->HasResult()) Update(inst, varying);
+      break;
+  }
+}
+
+void Solver::Solve(Function *main) {
+  MarkBlock(main->Entry());
+  while (!block_work.empty() || !value_work.empty()) {
+    if (!value_work.empty()) {
+      auto inst = value_work.back();
+      value_work.pop_back();
+      if (Executable(inst->parent)) Visit(inst);
+      continue;
+    }
+    auto bb = block_work.back();
+    block_work.pop_back();
+    for (auto inst : bb->insts) Visit(inst);
+  }
+}
+
+bool PropagateConstants(Module &module) {
+  auto main = module.FindFunction("main");
+  if (!main || main->IsDeclaration()) return false;
+  Solver solver(module);
+  solver.Solve(main);
+
+  bool changed = false;
+  for (auto func : module.functions) {
+    if (func->IsDeclaration() || !solver.Executable(func->Entry())) continue;
+    unordered_map<Value *, Value *> constants;
+    auto record = [&](Value *value) {
+      auto lattice = solver.Get(value);
+      if (lattice.state == Lattice::CONSTANT) constants[value] = module.Const(lattice.value);
+    };
+    for (auto arg : func->args) record(arg);
+    for (auto bb : func->blocks) {
+      if (!solver.Executable(bb)) continue;
+      for (auto inst : bb->insts) {
+        // Calls stay for their side effects; only their uses change.
+        if (inst->HasResult()) record(inst);
+      }
+    }
+    if (constants.empty()) continue;
+    ReplaceUses(*func, constants);
+    changed = true;
+  }
+  return changed;
+}
@@ -0,0 +1,560 @@
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <unordered_set>
+#include "ir.h"
+
+using namespace std;
+
+const Type *Type::Int32() {
+  static const Type type = {INT32, 0, nullptr};
+  return &type;
+}
+
+const Type *Type::Unit() {
+  static const Type type = {UNIT, 0, nullptr};
+  return &type;
+}
+
+const Type *Type::Array(const Type *base, int len) {
+  static map<pair<const Type *, int>, unique_ptr<Type>> pool;
+  auto &type = pool[{base, len}];
+  if (!type) type.reset(new Type{ARRAY, len, base});
+  return type.get();
+}
+
+const Type *Type::Pointer(const Type *base) {
+  static map<const Type *, unique_ptr<Type>> pool;
+  auto &type = pool[base];
+  if (!type) type.reset(new Type{POINTER, 0, base});
+  return type.get();
+}
+
+int Type::Size() const {
+  switch (tag) {
+    case INT32:
+    case POINTER:
+      return 4;
+    case ARRAY:
+      return len * base->Size();
+    default:
+      return 0;
+  }
+}
+
+void BasicBlock::InsertBeforeTerminator(Value *inst) {
+  inst->parent = this;
+  insts.insert(insts.end() - 1, inst);
+}
+
+Value *Module::NewValue(Op op, const Type *ty) {
+  values.emplace_back(new Value());
+  auto value = values.back().get();
+  value->op = op;
+  value->ty = ty;
+  return value;
+}
+
+Value *Module::Const(int value) {
+  auto &result = consts[value];
+  if (!result) {
+    result = NewValue(Op::INTEGER, Type::Int32());
+    result->imm = value;
+  }
+  return result;
+}
+
+Value *Module::Undef() {
+  if (!undef) undef = NewValue(Op::UNDEF, Type::Int32());
+  return undef;
+}
+
+BasicBlock *Module::NewBlock(Function *func, const string &name) {
+  bbs.emplace_back(new BasicBlock());
+  auto bb = bbs.back().get();
+  bb->name = name;
+  bb->parent = func;
+  return bb;
+}
+
+Function *Module::NewFunction(const string &name, const Type *ret_ty) {
+  funcs.emplace_back(new Function());
+  auto func = funcs.back().get();
+  func->name = name;
+  func->ret_ty = ret_ty;
+  return func;
+}
+
+Function *Module::FindFunction(const string &name) const {
+  for (auto func : functions) {
+    if (func->name == name) return func;
+  }
+  return nullptr;
+}
+
+string Module::UniqueName(const string &base) const {
+  auto taken = [&](const string &name) {
+    for (auto global : globals) {
+      if (global->name == name) return true;
+    }
+    return FindFunction(name) != nullptr;
+  };
+  string name = base;
+  for (int i = 1; taken(name); ++i) name = base + "_" + to_string(i);
+  return name;
+}
+
+Value *Module::NewGlobal(const string &name, const Type *ty) {
+  auto global = NewValue(Op::GLOBAL, Type::Pointer(ty));
+  global->name = UniqueName(name);
+  globals.push_back(global);
+  return global;
+}
+
+Value *Module::NewBinary(BinOp op, Value *lhs, Value *rhs) {
+  auto inst = NewValue(Op::BINARY, Type::Int32());
+  inst->binop = op;
+  inst->operands = {lhs, rhs};
+  return inst;
+}
+
+Value *Module::NewLoad(Value *src) {
+  auto inst = NewValue(Op::LOAD, src->ty->base);
+  inst->operands = {src};
+  return inst;
+}
+
+Value *Module::NewStore(Value *value, Value *dest) {
+  auto inst = NewValue(Op::STORE, Type::Unit());
+  inst->operands = {value, dest};
+  return inst;
+}
+
+Value *Module::NewJump(BasicBlock *target) {
+  auto inst = NewValue(Op::JUMP, Type::Unit());
+  inst->blocks = {target};
+  return inst;
+}
+
+Value *Module::NewBranch(Value *cond, BasicBlock *true_bb, BasicBlock *false_bb) {
+  auto inst = NewValue(Op::BRANCH, Type::Unit());
+  inst->operands = {cond};
+  inst->blocks = {true_bb, false_bb};
+  return inst;
+}
+
+Value *Module::NewPhi(const Type *ty) {
+  return NewValue(Op::PHI, ty);
+}
+
+bool EvalBinary(BinOp op, int lhs, int rhs, int *result) {
+  unsigned l = lhs, r = rhs;
+  switch (op) {
+    case BinOp::NOT_EQ: *result = lhs != rhs; return true;
+    case BinOp::EQ: *result = lhs == rhs; return true;
+    case BinOp::GT: *result = lhs > rhs; return true;
+    case BinOp::LT: *result = lhs < rhs; return true;
+    case BinOp::GE: *result = lhs >= rhs; return true;
+    case BinOp::LE: *result = lhs <= rhs; return true;
+    case BinOp::ADD: *result = (int)(l + r); return true;
+    case BinOp::SUB: *result = (int)(l - r); return true;
+    case BinOp::MUL: *result = (int)(l * r); return true;
+    case BinOp::DIV:
+    case BinOp::MOD:
+      if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) return false;
+      *result = op == BinOp::DIV ? lhs / rhs : lhs % rhs;
+      return true;
+    // Logical, as the backend lowers them.
+    case BinOp::AND: *result = lhs && rhs; return true;
+    case BinOp::OR: *result = lhs || rhs; return true;
+    default: return false;
+  }
+}
+
+static const Type *ConvertType(koopa_raw_type_t ty) {
+  switch (ty->tag) {
+    case KOOPA_RTT_INT32:
+      return Type::Int32();
+    case KOOPA_RTT_UNIT:
+      return Type::Unit();
+    case KOOPA_RTT_ARRAY:
+      return Type::Array(ConvertType(ty->data.array.base), (int)ty->data.array.len);
+    case KOOPA_RTT_POINTER:
+      return Type::Pointer(ConvertType(ty->data.pointer.base));
+    default:
+      assert(false);
+      return nullptr;
+  }
+}
+
+static void FlattenInit(koopa_raw_value_t init, vector<int> &out) {
+  if (init->kind.tag == KOOPA_RVT_AGGREGATE) {
+    const auto &elems = init->kind.data.aggregate.elems;
+    for (size_t i = 0; i < elems.len; ++i) {
+      FlattenInit(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]), out);
+    }
+  } else if (init->kind.tag == KOOPA_RVT_INTEGER) {
+    out.push_back(init->kind.data.integer.value);
+  } else {
+    out.insert(out.end(), ConvertType(init->ty)->Size() / 4, 0);
+  }
+}
+
+static BinOp ConvertBinOp(koopa_raw_binary_op_t op) {
+  switch (op) {
+    case KOOPA_RBO_NOT_EQ: return BinOp::NOT_EQ;
+    case KOOPA_RBO_EQ: return BinOp::EQ;
+    case KOOPA_RBO_GT: return BinOp::GT;
+    case KOOPA_RBO_LT: return BinOp::LT;
+    case KOOPA_RBO_GE: return BinOp::GE;
+    case KOOPA_RBO_LE: return BinOp::LE;
+    case KOOPA_RBO_ADD: return BinOp::ADD;
+    case KOOPA_RBO_SUB: return BinOp::SUB;
+    case KOOPA_RBO_MUL: return BinOp::MUL;
+    case KOOPA_RBO_DIV: return BinOp::DIV;
+    case KOOPA_RBO_MOD: return BinOp::MOD;
+    case KOOPA_RBO_AND: return BinOp::AND;
+    case KOOPA_RBO_OR: return BinOp::OR;
+    case KOOPA_RBO_XOR: return BinOp::XOR;
+    case KOOPA_RBO_SHL: return BinOp::SHL;
+    case KOOPA_RBO_SHR: return BinOp::SHR;
+    case KOOPA_RBO_SAR: return BinOp::SAR;
+    default: assert(false); return BinOp::ADD;
+  }
+}
+
+unique_ptr<Module> BuildModule(const koopa_raw_program_t &raw) {
+  unique_ptr<Module> module(new Module());
+  unordered_map<const void *, Value *> value_map;
+  unordered_map<const void *, Function *> func_map;
+
+  for (size_t i = 0; i < raw.values.len; ++i) {
+    auto global = reinterpret_cast<koopa_raw_value_t>(raw.values.buffer[i]);
+    auto value = module->NewValue(Op::GLOBAL, ConvertType(global->ty));
+    value->name = global->name + 1;
+    auto init = global->kind.data.global_alloc.init;
+    if (init->kind.tag != KOOPA_RVT_ZERO_INIT) {
+      FlattenInit(init, value->init);
+    }
+    value_map[global] = value;
+    module->globals.push_back(value);
+  }
+
+  for (size_t i = 0; i < raw.funcs.len; ++i) {
+    auto raw_func = reinterpret_cast<koopa_raw_function_t>(raw.funcs.buffer[i]);
+    const auto &func_ty = raw_func->ty->data.function;
+    auto func = module->NewFunction(raw_func->name + 1, ConvertType(func_ty.ret));
+    for (size_t j = 0; j < func_ty.params.len; ++j) {
+      auto arg = module->NewValue(Op::ARG, ConvertType(reinterpret_cast<koopa_raw_type_t>(func_ty.params.buffer[j])));
+      arg->imm = (int)j;
+      if (j < raw_func->params.len) {
+        auto raw_arg = reinterpret_cast<koopa_raw_value_t>(raw_func->params.buffer[j]);
+        if (raw_arg->name) arg->name = raw_arg->name + 1;
+      }
+      func->args.push_back(arg);
+    }
+    func_map[raw_func] = func;
+    module->functions.push_back(func);
+  }
+
+  for (size_t i = 0; i < raw.funcs.len; ++i) {
+    auto raw_func = reinterpret_cast<koopa_raw_function_t>(raw.funcs.buffer[i]);
+    auto func = func_map[raw_func];
+    unordered_map<const void *, BasicBlock *> bb_map;
+    for (size_t j = 0; j < raw_func->bbs.len; ++j) {
+      auto raw_bb = reinterpret_cast<koopa_raw_basic_block_t>(raw_func->bbs.buffer[j]);
+      auto bb = module->NewBlock(func, raw_bb->name ? raw_bb->name + 1 : "bb");
+      bb_map[raw_bb] = bb;
+      func->blocks.push_back(bb);
+      for (size_t k = 0; k < raw_bb->insts.len; ++k) {
+        auto raw_inst = reinterpret_cast<koopa_raw_value_t>(raw_bb->insts.buffer[k]);
+        Op op;
+        switch (raw_inst->kind.tag) {
+          case KOOPA_RVT_ALLOC: op = Op::ALLOC; break;
+          case KOOPA_RVT_LOAD: op = Op::LOAD; break;
+          case KOOPA_RVT_STORE: op = Op::STORE; break;
+          case KOOPA_RVT_GET_PTR: op = Op::GET_PTR; break;
+          case KOOPA_RVT_GET_ELEM_PTR: op = Op::GET_ELEM_PTR; break;
+          case KOOPA_RVT_BINARY: op = Op::BINARY; break;
+          case KOOPA_RVT_CALL: op = Op::CALL; break;
+          case KOOPA_RVT_BRANCH: op = Op::BRANCH; break;
+          case KOOPA_RVT_JUMP: op = Op::JUMP; break;
+          case KOOPA_RVT_RETURN: op = Op::RETURN; break;
+          default: assert(false); op = Op::UNDEF;
+        }
+        auto inst = module->NewValue(op, ConvertType(raw_inst->ty));
+        if (op == Op::ALLOC && raw_inst->name) inst->name = raw_inst->name + 1;
+        inst->parent = bb;
+        bb->insts.push_back(inst);
+        value_map[raw_inst] = inst;
+      }
+    }
+
+    auto get = [&](koopa_raw_value_t raw_value) -> Value * {
+      switch (raw_value->kind.tag) {
+        case KOOPA_RVT_INTEGER:
+          return module->Const(raw_value->kind.data.integer.value);
+        case KOOPA_RVT_FUNC_ARG_REF:
+          return func->args[raw_value->kind.data.func_arg_ref.index];
+        case KOOPA_RVT_ZERO_INIT:
+        case KOOPA_RVT_UNDEF:
+          return module->Undef();
+        default:
+          return value_map.at(raw_value);
+      }
+    };
+    for (size_t j = 0; j < raw_func->bbs.len; ++j) {
+      auto raw_bb = reinterpret_cast<koopa_raw_basic_block_t>(raw_func->bbs.buffer[j]);
+      for (size_t k = 0; k < raw_bb->insts.len; ++k) {
+        auto raw_inst = reinterpret_cast<koopa_raw_value_t>(raw_bb->insts.buffer[k]);
+        auto inst = value_map[raw_inst];
+        const auto &kind = raw_inst->kind;
+        switch (kind.tag) {
+          case KOOPA_RVT_LOAD:
+            inst->operands = {get(kind.data.load.src)};
+            break;
+          case KOOPA_RVT_STORE:
+            inst->operands = {get(kind.data.store.value), get(kind.data.store.dest)};
+            break;
+          case KOOPA_RVT_GET_PTR:
+            inst->operands = {get(kind.data.get_ptr.src), get(kind.data.get_ptr.index)};
+            break;
+          case KOOPA_RVT_GET_ELEM_PTR:
+            inst->operands = {get(kind.data.get_elem_ptr.src), get(kind.data.get_elem_ptr.index)};
+            break;
+          case KOOPA_RVT_BINARY:
+            inst->binop = ConvertBinOp(kind.data.binary.op);
+            inst->operands = {get(kind.data.binary.lhs), get(kind.data.binary.rhs)};
+            break;
+          case KOOPA_RVT_CALL:
+            inst->callee = func_map.at(kind.data.call.callee);
+            for (size_t a = 0; a < kind.data.call.args.len; ++a) {
+              inst->operands.push_back(get(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[a])));
+            }
+            break;
+          case KOOPA_RVT_BRANCH:
+            inst->operands = {get(kind.data.branch.cond)};
+            inst->blocks = {bb_map.at(kind.data.branch.true_bb), bb_map.at(kind.data.branch.false_bb)};
+            break;
+          case KOOPA_RVT_JUMP:
+            inst->blocks = {bb_map.at(kind.data.jump.target)};
+            break;
+          case KOOPA_RVT_RETURN:
+            if (kind.data.ret.value) inst->operands = {get(kind.data.ret.value)};
+            break;
+          default:
+            break;
+        }
+      }
+    }
+  }
+  return module;
+}
+
+static void PrintType(ostream &os, const Type *ty) {
+  switch (ty->tag) {
+    case Type::INT32:
+      os << "i32";
+      break;
+    case Type::POINTER:
+      os << "*";
+      PrintType(os, ty->base);
+      break;
+    case Type::ARRAY:
+      os << "[";
+      PrintType(os, ty->base);
+      os << ", " << ty->len << "]";
+      break;
+    default:
+      assert(false);
+  }
+}
+
+static void PrintInit(ostream &os, const Type *ty, const vector<int> &init, size_t &pos) {
+  if (ty->tag != Type::ARRAY) {
+    os << init[pos++];
+    return;
+  }
+  os << "{";
+  for (int i = 0; i < ty->len; ++i) {
+    if (i) os << ", ";
+    PrintInit(os, ty->base, init, pos);
+  }
+  os << "}";
+}
+
+static const char *BinOpName(BinOp op) {
+  static const char *const names[] = {
+    "ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "shr", "sar"
+  };
+  return names[static_cast<int>(op)];
+}
+
+// Blocks in reverse postorder, visiting the true successor of a branch last so
+// that it ends up right after the branch. Definitions then always precede
+// their uses in the printed text.
+static vector<BasicBlock *> LayoutBlocks(const Function &func) {
+  vector<BasicBlock *> order;
+  unordered_set<BasicBlock *> visited;
+  vector<pair<BasicBlock *, size_t>> stack = {{func.Entry(), 0}};
+  visited.insert(func.Entry());
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    const auto &targets = top.first->Terminator()->blocks;
+    if (top.second < targets.size()) {
+      auto succ = targets[targets.size() - 1 - top.second++];
+      if (visited.insert(succ).second) stack.push_back({succ, 0});
+    } else {
+      order.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  return vector<BasicBlock *>(order.rbegin(), order.rend());
+}
+
+static void PrintFunction(ostream &os, const Function &func, const unordered_set<string> &global_names) {
+  unordered_set<string> used(global_names);
+  unordered_map<const void *, string> names;
+  auto unique = [&](const string &base) {
+    string name = base;
+    for (int i = 1; used.count(name); ++i) name = base + "_" + to_string(i);
+    used.insert(name);
+    return name;
+  };
+  auto layout = LayoutBlocks(func);
+  used.insert("%entry");
+  names[layout[0]] = "%entry";
+  for (size_t i = 1; i < layout.size(); ++i) {
+    names[layout[i]] = unique("%" + layout[i]->name);
+  }
+  for (auto arg : func.args) {
+    names[arg] = unique("%" + (arg->name.empty() ? "arg" : arg->name));
+  }
+  int counter = 0;
+  for (auto bb : layout) {
+    for (auto inst : bb->insts) {
+      assert(inst->op != Op::PHI);
+      if (inst->op == Op::ALLOC) {
+        names[inst] = unique("@" + (inst->name.empty() ? "tmp" : inst->name));
+      } else if (inst->HasResult()) {
+        names[inst] = unique("%" + to_string(counter++));
+      }
+    }
+  }
+  auto operand = [&](const Value *value) -> string {
+    switch (value->op) {
+      case Op::INTEGER:
+        return to_string(value->imm);
+      case Op::UNDEF:
+        return "0";
+      case Op::GLOBAL:
+        return "@" + value->name;
+      default:
+        return names.at(value);
+    }
+  };
+
+  os << "fun @" << func.name << "(";
+  for (size_t i = 0; i < func.args.size(); ++i) {
+    if (i) os << ", ";
+    os << names[func.args[i]] << ": ";
+    PrintType(os, func.args[i]->ty);
+  }
+  os << ")";
+  if (func.ret_ty->tag != Type::UNIT) {
+    os << ": ";
+    PrintType(os, func.ret_ty);
+  }
+  os << " {" << endl;
+  for (auto bb : layout) {
+    os << names[bb] << ":" << endl;
+    for (auto inst : bb->insts) {
+      os << "  ";
+      if (inst->HasResult()) os << names[inst] << " = ";
+      const auto &ops = inst->operands;
+      switch (inst->op) {
+        case Op::ALLOC:
+          os << "alloc ";
+          PrintType(os, inst->ty->base);
+          break;
+        case Op::LOAD:
+          os << "load " << operand(ops[0]);
+          break;
+        case Op::STORE:
+          os << "store " << operand(ops[0]) << ", " << operand(ops[1]);
+          break;
+        case Op::GET_PTR:
+          os << "getptr " << operand(ops[0]) << ", " << operand(ops[1]);
+          break;
+        case Op::GET_ELEM_PTR:
+          os << "getelemptr " << operand(ops[0]) << ", " << operand(ops[1]);
+          break;
+        case Op::BINARY:
+          os << BinOpName(inst->binop) << " " << operand(ops[0]) << ", " << operand(ops[1]);
+          break;
+        case Op::CALL:
+          os << "call @" << inst->callee->name << "(";
+          for (size_t i = 0; i < ops.size(); ++i) {
+            if (i) os << ", ";
+            os << operand(ops[i]);
+          }
+          os << ")";
+          break;
+        case Op::BRANCH:
+          os << "br " << operand(ops[0]) << ", " << names.at(inst->blocks[0]) << ", " << names.at(inst->blocks[1]);
+          break;
+        case Op::JUMP:
+          os << "jump " << names.at(inst->blocks[0]);
+          break;
+        case Op::RETURN:
+          os << "ret";
+          if (!ops.empty()) os << " " << operand(ops[0]);
+          break;
+        default:
+          assert(false);
+      }
+      os << endl;
+    }
+  }
+  os << "}" << endl << endl;
+}
+
+string PrintModule(const Module &module) {
+  ostringstream os;
+  unordered_set<string> global_names;
+  for (auto func : module.functions) {
+    global_names.insert("@" + func->name);
+    if (!func->IsDeclaration()) continue;
+    os << "decl @" << func->name << "(";
+    for (size_t i = 0; i < func->args.size(); ++i) {
+      if (i) os << ", ";
+      PrintType(os, func->args[i]->ty);
+    }
+    os << ")";
+    if (func->ret_ty->tag != Type::UNIT) {
+      os << ": ";
+      PrintType(os, func->ret_ty);
+    }
+    os << endl;
+  }
+  os << endl;
+  for (auto global : module.globals) {
+    global_names.insert("@" + global->name);
+    os << "global @" << global->name << " = alloc ";
+    PrintType(os, global->ty->base);
+    os << ", ";
+    if (global->init.empty()) {
+      os << "zeroinit";
+    } else {
+      size_t pos = 0;
+      PrintInit(os, global->ty->base, global->init, pos);
+    }
+    os << endl << endl;
+  }
+  for (auto func : module.functions) {
+    if (!func->IsDeclaration()) PrintFunction(os, *func, global_names);
+  }
+  return os.str();
+}
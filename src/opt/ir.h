@@ -0,0 +1,260 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "koopa.h"
+
+// A mutable copy of the Koopa IR program that the optimizer works on. It is
+// built from the raw program produced by libkoopa and printed back to Koopa
+// text once the passes are done, so the backend never sees these structures.
+
+struct Type {
+  enum Tag { INT32, UNIT, ARRAY, POINTER };
+  Tag tag;
+  int len;
+  const Type *base;
+
+  // Types are interned, so two types are equal iff their pointers are.
+  static const Type *Int32();
+  static const Type *Unit();
+  static const Type *Array(const Type *base, int len);
+  static const Type *Pointer(const Type *base);
+  // Size in bytes of a value of this type.
+  int Size() const;
+};
+
+enum class Op {
+  INTEGER,
+  UNDEF,
+  ARG,
+  GLOBAL,
+  ALLOC,
+  LOAD,
+  STORE,
+  GET_PTR,
+  GET_ELEM_PTR,
+  BINARY,
+  PHI,
+  CALL,
+  BRANCH,
+  JUMP,
+  RETURN
+};
+
+enum class BinOp { NOT_EQ, EQ, GT, LT, GE, LE, ADD, SUB, MUL, DIV, MOD, AND, OR, XOR, SHL, SHR, SAR };
+
+struct BasicBlock;
+struct Function;
+
+// Operands by opcode:
+//   LOAD {src}, STORE {value, dest}, GET_PTR/GET_ELEM_PTR {src, index},
+//   BINARY {lhs, rhs}, PHI {one per incoming block}, CALL {args...},
+//   BRANCH {cond}, RETURN {} or {value}.
+// blocks holds the BRANCH targets (true, false), the JUMP target and the
+// incoming blocks of a PHI, in operand order.
+struct Value {
+  Op op;
+  const Type *ty;
+  BinOp binop = BinOp::ADD;
+  int imm = 0;  // INTEGER value, ARG index
+  std::string name;  // GLOBAL and ALLOC names, without the '@'
+  std::vector<Value *> operands;
+  std::vector<BasicBlock *> blocks;
+  Function *callee = nullptr;
+  BasicBlock *parent = nullptr;
+  // Flattened GLOBAL initializer; empty means zeroinit.
+  std::vector<int> init;
+  // GLOBAL that nothing writes, so it holds init for good. Set by
+  // FoldConstantGlobals.
+  bool constant = false;
+
+  bool IsConst() const { return op == Op::INTEGER; }
+  bool IsTerminator() const { return op == Op::BRANCH || op == Op::JUMP || op == Op::RETURN; }
+  bool HasResult() const { return ty->tag != Type::UNIT; }
+};
+
+struct BasicBlock {
+  std::string name;  // without the '%'
+  std::vector<Value *> insts;
+  Function *parent = nullptr;
+  // Filled by BuildCFG.
+  std::vector<BasicBlock *> preds, succs;
+
+  Value *Terminator() const { return insts.back(); }
+  // Inserts inst right before the terminator.
+  void InsertBeforeTerminator(Value *inst);
+};
+
+struct Function {
+  std::string name;  // without the '@'
+  std::vector<Value *> args;
+  const Type *ret_ty;
+  std::vector<BasicBlock *> blocks;  // blocks[0] is the entry
+  // Filled by InferAttributes; false when unknown.
+  bool pure = false;        // touches no memory but its locals, has no other effects
+  bool readonly = false;    // writes no memory but its locals, has no other effects
+  bool argmemonly = false;  // touches no memory but its locals and what its arguments point to
+  bool norecurse = false;   // never calls itself, directly or not
+  bool willreturn = false;  // always returns: no recursion, loops or calls that might not
+
+  bool IsDeclaration() const { return blocks.empty(); }
+  BasicBlock *Entry() const { return blocks[0]; }
+};
+
+class Module {
+public:
+  std::vector<Value *> globals;
+  std::vector<Function *> functions;
+
+  Value *NewValue(Op op, const Type *ty);
+  Value *Const(int value);
+  Value *Undef();
+  BasicBlock *NewBlock(Function *func, const std::string &name);
+  Function *NewFunction(const std::string &name, const Type *ret_ty);
+  Function *FindFunction(const std::string &name) const;
+  // A name based on base that no global or function uses yet.
+  std::string UniqueName(const std::string &base) const;
+  // Adds a zero-initialized global holding a ty, named after name.
+  Value *NewGlobal(const std::string &name, const Type *ty);
+
+  Value *NewBinary(BinOp op, Value *lhs, Value *rhs);
+  Value *NewLoad(Value *src);
+  Value *NewStore(Value *value, Value *dest);
+  Value *NewJump(BasicBlock *target);
+  Value *NewBranch(Value *cond, BasicBlock *true_bb, BasicBlock *false_bb);
+  Value *NewPhi(const Type *ty);
+
+private:
+  std::vector<std::unique_ptr<Value>> values;
+  std::vector<std::unique_ptr<BasicBlock>> bbs;
+  std::vector<std::unique_ptr<Function>> funcs;
+  std::unordered_map<int, Value *> consts;
+  Value *undef = nullptr;
+};
+
+// Evaluates a binary operation on constants the way the generated code would.
+// Fails for divisions that trap or overflow and for unsupported operators.
+bool EvalBinary(BinOp op, int lhs, int rhs, int *result);
+
+std::unique_ptr<Module> BuildModule(const koopa_raw_program_t &raw);
+std::string PrintModule(const Module &module);
+
+// Fills preds and succs of every block of func.
+void BuildCFG(Function &func);
+// Drops blocks unreachable from the entry and their incoming phi edges.
+// Rebuilds the CFG; returns whether anything was removed.
+bool RemoveUnreachableBlocks(Function &func);
+// Rewrites every operand of func according to map, following chains.
+void ReplaceUses(Function &func, const std::unordered_map<Value *, Value *> &map);
+// The value phi takes when entered from pred, or null if pred is not incoming.
+Value *PhiIncoming(Value *phi, BasicBlock *pred);
+// Removes the incoming edge from pred from every phi of bb.
+void RemovePhiIncoming(BasicBlock *bb, BasicBlock *pred);
+// Whether inst must be kept even if its result is unused.
+bool HasSideEffects(const Value *inst);
+// Whether the address ptr is derived from a local alloc, which it returns.
+Value *LocalRoot(Value *ptr);
+
+// The object the address ptr points into: a local ALLOC, a GLOBAL, a pointer
+// ARG, or null if unknown. offset receives the constant byte offset of ptr in
+// it, or -1 if some index is not constant.
+Value *PointerRoot(Value *ptr, int *offset);
+// Whether i32 accesses through the addresses a and b may overlap. Accesses
+// to constant globals overlap no write, so they are taken not to.
+bool MayAlias(Value *a, Value *b);
+// Whether the address ptr points into a constant global.
+bool IsConstantMemory(Value *ptr);
+// The value a load from ptr yields if ptr is a known element of a constant
+// global, or null.
+Value *LoadedConstant(Module &module, Value *ptr);
+// Local allocs whose address is passed to some call of func.
+std::unordered_set<Value *> EscapedAllocs(Function &func);
+// Whether call may write the memory at ptr, given the escaped allocs.
+bool CallMayClobber(Value *call, Value *ptr, const std::unordered_set<Value *> &escaped);
+// Whether call may read or write the memory at ptr, given the escaped allocs.
+bool CallMayAccess(Value *call, Value *ptr, const std::unordered_set<Value *> &escaped);
+
+// Dominator tree, or post-dominator tree if post is set. In the latter a null
+// block stands for the virtual exit that follows every return. Requires an
+// up-to-date CFG.
+class DominatorTree {
+public:
+  DominatorTree(Function &func, bool post = false);
+
+  BasicBlock *IDom(BasicBlock *bb) const;
+  bool Dominates(BasicBlock *a, BasicBlock *b) const;
+  bool Reachable(BasicBlock *bb) const { return index.count(bb) != 0; }
+  const std::vector<BasicBlock *> &Children(BasicBlock *bb) const;
+  // Blocks in reverse postorder of the (reversed, if post) CFG.
+  const std::vector<BasicBlock *> &Order() const { return order; }
+  // Dominance frontier of every reachable block.
+  std::unordered_map<BasicBlock *, std::vector<BasicBlock *>> Frontiers() const;
+
+private:
+  bool post;
+  std::vector<BasicBlock *> order;
+  std::unordered_map<BasicBlock *, int> index;
+  std::vector<int> idom;
+  std::vector<std::vector<BasicBlock *>> children;
+  std::vector<int> depth;
+  const std::vector<BasicBlock *> &Preds(BasicBlock *bb) const;
+  std::vector<BasicBlock *> exit_preds;
+};
+
+// A natural loop: the header and every block that reaches one of its back
+// edges without passing through the header.
+struct Loop {
+  BasicBlock *header;
+  Loop *parent = nullptr;
+  std::unordered_set<BasicBlock *> blocks;
+  std::vector<BasicBlock *> latches;  // sources of the back edges
+  int depth = 1;
+
+  bool Contains(BasicBlock *bb) const { return blocks.count(bb) != 0; }
+  bool Contains(const Value *inst) const { return inst->parent && Contains(inst->parent); }
+  // The only predecessor of the header outside the loop, provided it jumps
+  // straight to the header; null otherwise.
+  BasicBlock *Preheader() const;
+  // Blocks of the loop with a successor outside it.
+  std::vector<BasicBlock *> ExitingBlocks() const;
+};
+
+// The natural loops of a function, found from the back edges of the dominator
+// tree. Loops sharing a header are merged.
+class LoopInfo {
+public:
+  LoopInfo(Function &func, const DominatorTree &dom);
+
+  // Inner loops come before the loops containing them.
+  const std::vector<Loop *> &Loops() const { return order; }
+  // The innermost loop containing bb, or null.
+  Loop *LoopFor(BasicBlock *bb) const;
+
+private:
+  std::vector<std::unique_ptr<Loop>> loops;
+  std::vector<Loop *> order;
+  std::unordered_map<BasicBlock *, Loop *> innermost;
+};
+
+// Gives every loop of func a preheader, splitting the edges entering its
+// header into a new block when needed. Rebuilds the CFG; returns whether
+// anything changed. Dominator trees and loop info must be recomputed.
+bool InsertPreheaders(Module &module, Function &func);
+
+// The functions func calls, each once, in order of first call.
+std::vector<Function *> Callees(const Function &func);
+// The defined functions of module grouped into the strongly connected
+// components of the call graph, every component after those it calls into.
+std::vector<std::vector<Function *>> CallGraphSCCs(const Module &module);
+// Drops the defined functions other than main that nothing calls any more,
+// and then those only they called. Returns whether any were dropped.
+bool RemoveUncalledFunctions(Module &module);
+// Whether the functions of a component call themselves, directly or not.
+bool IsRecursive(const std::vector<Function *> &scc);
+// Sets the attributes of every function: by hand for the runtime library,
+// bottom-up over the call graph for the others. Calls within a component
+// add nothing to what its functions do themselves.
+void InferAttributes(Module &module);
@@ -0,0 +1,159 @@
+#include <map>
+#include <tuple>
+#include "passes.h"
+
+using namespace std;
+
+namespace {
+
+// The value scale * iv + offset, where iv is a basic induction variable of the
+// loop (null for a loop-invariant value) and offset is invariant.
+struct Affine {
+  Value *iv;
+  int scale;
+  Value *offset;
+};
+
+class InductionRewriter {
+public:
+  InductionRewriter(Module &module, Loop &loop, BasicBlock *preheader, BasicBlock *latch)
+      : module(module), loop(loop), preheader(preheader), latch(latch) {}
+
+  bool Run();
+
+private:
+  Module &module;
+  Loop &loop;
+  BasicBlock *preheader, *latch;
+  // Basic induction variables: header phis advanced by a constant step.
+  unordered_map<Value *, int> steps;
+  unordered_map<Value *, Value *> inits;
+  unordered_map<Value *, bool> analyzed;
+  unordered_map<Value *, Affine> affine;
+
+  bool Analyze(Value *value);
+  // Emits lhs op rhs in the preheader, folding constants.
+  Value *Emit(BinOp op, Value *lhs, Value *rhs);
+};
+
+}  // namespace
+
+Value *InductionRewriter::Emit(BinOp op, Value *lhs, Value *rhs) {
+  int result;
+  if (lhs->IsConst() && rhs->IsConst() && EvalBinary(op, lhs->imm, rhs->imm, &result)) return module.Const(result);
+  if (op == BinOp::ADD && lhs->IsConst() && lhs->imm == 0) return rhs;
+  if ((op == BinOp::ADD || op == BinOp::SUB) && rhs->IsConst() && rhs->imm == 0) return lhs;
+  if (op == BinOp::MUL && rhs->IsConst() && rhs->imm == 1) return lhs;
+  auto inst = module.NewBinary(op, lhs, rhs);
+  preheader->InsertBeforeTerminator(inst);
+  return inst;
+}
+
+bool InductionRewriter::Analyze(Value *value) {
+  auto it = analyzed.find(value);
+  if (it != analyzed.end()) return it->second;
+  bool ok = false;
+  Affine result = {nullptr, 0, module.Const(0)};
+  if (!loop.Contains(value)) {
+    result.offset = value;
+    ok = true;
+  } else if (steps.count(value)) {
+    result = {value, 1, module.Const(0)};
+    ok = true;
+  } else if (value->op == Op::BINARY) {
+    auto lhs = value->operands[0], rhs = value->operands[1];
+    switch (value->binop) {
+      case BinOp::ADD:
+      case BinOp::SUB: {
+        if (!Analyze(lhs) || !Analyze(rhs)) break;
+        auto &l = affine[lhs], &r = affine[rhs];
+        if (l.iv && r.iv && l.iv != r.iv) break;
+        int sign = value->binop == BinOp::ADD ? 1 : -1;
+        result = {l.iv ? l.iv : r.iv, (int)((unsigned)l.scale + sign * (unsigned)r.scale),
+                  Emit(value->binop, l.offset, r.offset)};
+        ok = true;
+        break;
+      }
+      case BinOp::MUL: {
+        if (lhs->IsConst()) swap(lhs, rhs);
+        if (!rhs->IsConst() || !Analyze(lhs)) break;
+        auto &l = affine[lhs];
+        result = {l.iv, (int)((unsigned)l.scale * (unsigned)rhs->imm), Emit(BinOp::MUL, l.offset, rhs)};
+        ok = true;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  if (ok) affine[value] = result;
+  analyzed[value] = ok;
+  return ok;
+}
+
+bool InductionRewriter::Run() {
+  for (auto phi : loop.header->insts) {
+    if (phi->op != Op::PHI) break;
+    auto next = PhiIncoming(phi, latch);
+    if (!next || next->op != Op::BINARY) continue;
+    auto lhs = next->operands[0], rhs = next->operands[1];
+    if (next->binop == BinOp::ADD && lhs->IsConst()) swap(lhs, rhs);
+    if (lhs != phi || !rhs->IsConst()) continue;
+    if (next->binop == BinOp::ADD) {
+      steps[phi] = rhs->imm;
+    } else if (next->binop == BinOp::SUB) {
+      steps[phi] = (int)(0u - (unsigned)rhs->imm);
+    } else {
+      continue;
+    }
+    inits[phi] = PhiIncoming(phi, preheader);
+  }
+  if (steps.empty()) return false;
+
+  // Each address src[scale * iv + offset] becomes a pointer of its own that
+  // starts at src[scale * init + offset] and moves by scale * step elements
+  // per iteration.
+  map<tuple<Op, Value *, Value *, int, Value *>, Value *> pointers;
+  unordered_map<Value *, Value *> replace;
+  for (auto bb : loop.header->parent->blocks) {
+    if (!loop.Contains(bb)) continue;
+    for (auto inst : bb->insts) {
+      if (inst->op != Op::GET_PTR && inst->op != Op::GET_ELEM_PTR) continue;
+      auto src = inst->operands[0];
+      if (loop.Contains(src) || !Analyze(inst->operands[1])) continue;
+      auto index = affine[inst->operands[1]];
+      if (!index.iv || !index.scale) continue;
+      auto &pointer = pointers[make_tuple(inst->op, src, index.iv, index.scale, index.offset)];
+      if (!pointer) {
+        auto start = module.NewValue(inst->op, inst->ty);
+        start->operands = {src, Emit(BinOp::ADD, Emit(BinOp::MUL, inits[index.iv], module.Const(index.scale)),
+                                     index.offset)};
+        preheader->InsertBeforeTerminator(start);
+        pointer = module.NewPhi(inst->ty);
+        pointer->parent = loop.header;
+        loop.header->insts.insert(loop.header->insts.begin(), pointer);
+        auto next = module.NewValue(Op::GET_PTR, inst->ty);
+        next->operands = {pointer, module.Const((int)((unsigned)index.scale * (unsigned)steps[index.iv]))};
+        latch->InsertBeforeTerminator(next);
+        pointer->operands = {start, next};
+        pointer->blocks = {preheader, latch};
+      }
+      replace[inst] = pointer;
+    }
+  }
+  ReplaceUses(*loop.header->parent, replace);
+  return !replace.empty();
+}
+
+bool ReduceInductionVariables(Module &module, Function &func) {
+  InsertPreheaders(module, func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  bool changed = false;
+  for (auto loop : loops.Loops()) {
+    auto preheader = loop->Preheader();
+    if (!preheader || loop->latches.size() != 1) continue;
+    changed |= InductionRewriter(module, *loop, preheader, loop->latches[0]).Run();
+  }
+  return changed;
+}
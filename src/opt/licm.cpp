@@ -0,0 +1,90 @@
+#include <algorithm>
+#include "passes.h"
+
+using namespace std;
+
+// Whether loading from ptr cannot fault: it lies inside a global or local
+// object at a constant offset.
+static bool IsDereferenceable(Value *ptr) {
+  int offset;
+  auto root = PointerRoot(ptr, &offset);
+  if (!root || root->op == Op::ARG || offset < 0) return false;
+  return offset + Type::Int32()->Size() <= root->ty->base->Size();
+}
+
+bool LoopInvariantCodeMotion(Module &module, Function &func) {
+  InsertPreheaders(module, func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  auto escaped = EscapedAllocs(func);
+  bool changed = false;
+  for (auto loop : loops.Loops()) {
+    auto preheader = loop->Preheader();
+    if (!preheader) continue;
+    vector<Value *> stored, calls;
+    for (auto bb : loop->blocks) {
+      for (auto inst : bb->insts) {
+        if (inst->op == Op::STORE) stored.push_back(inst->operands[1]);
+        if (inst->op == Op::CALL && !inst->callee->readonly) calls.push_back(inst);
+      }
+    }
+    auto exiting = loop->ExitingBlocks();
+    // Whether bb runs in every iteration that leaves the loop, hence at least
+    // once whenever the preheader does.
+    auto always_runs = [&](BasicBlock *bb) {
+      return all_of(exiting.begin(), exiting.end(), [&](BasicBlock *exit) { return dom.Dominates(bb, exit); });
+    };
+    auto invariant = [&](Value *value) { return !loop->Contains(value); };
+    auto can_hoist = [&](Value *inst) {
+      if (!all_of(inst->operands.begin(), inst->operands.end(), invariant)) return false;
+      switch (inst->op) {
+        case Op::BINARY: {
+          if (inst->binop != BinOp::DIV && inst->binop != BinOp::MOD) return true;
+          // A division must not trap on a path that would not have run it.
+          auto rhs = inst->operands[1];
+          return (rhs->IsConst() && rhs->imm != 0 && rhs->imm != -1) || always_runs(inst->parent);
+        }
+        case Op::GET_PTR:
+        case Op::GET_ELEM_PTR:
+          return true;
+        case Op::LOAD: {
+          auto ptr = inst->operands[0];
+          for (auto call : calls) {
+            if (CallMayClobber(call, ptr, escaped)) return false;
+          }
+          for (auto dest : stored) {
+            if (MayAlias(ptr, dest)) return false;
+          }
+          return IsDereferenceable(ptr) || always_runs(inst->parent);
+        }
+        case Op::CALL:
+          // A readonly call sees the same memory every iteration only if the
+          // loop writes none it can reach, and as it may trap or never return
+          // it must run at least once anyway.
+          if (!inst->callee->readonly || !always_runs(inst->parent)) return false;
+          return inst->callee->pure || (calls.empty() && all_of(stored.begin(), stored.end(), [&](Value *dest) {
+                   auto root = LocalRoot(dest);
+                   return root && !escaped.count(root);
+                 }));
+        default:
+          return false;
+      }
+    };
+    // Visiting in dominator order sees definitions before their uses, so a
+    // whole invariant chain moves in one sweep.
+    for (auto bb : dom.Order()) {
+      if (!loop->Contains(bb)) continue;
+      vector<Value *> kept;
+      for (auto inst : bb->insts) {
+        if (can_hoist(inst)) {
+          preheader->InsertBeforeTerminator(inst);
+          changed = true;
+        } else {
+          kept.push_back(inst);
+        }
+      }
+      bb->insts.swap(kept);
+    }
+  }
+  return changed;
+}
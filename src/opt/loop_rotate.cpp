@@ -0,0 +1,57 @@
+#include <unordered_set>
+#include "passes.h"
+
+using namespace std;
+
+// Headers longer than this are not worth duplicating into every latch.
+static const size_t kMaxRotatedHeaderSize = 16;
+
+bool RotateLoops(Module &module, Function &func) {
+  RemoveUnreachableBlocks(func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  // Values used outside the block defining them; a header defining one would
+  // need phis once duplicated.
+  unordered_set<Value *> used_outside;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      for (auto operand : inst->operands) {
+        if (operand->parent && operand->parent != bb) used_outside.insert(operand);
+      }
+    }
+  }
+  bool changed = false;
+  for (auto loop : loops.Loops()) {
+    auto header = loop->header;
+    auto term = header->Terminator();
+    if (header == func.Entry() || term->op != Op::BRANCH || header->insts.size() > kMaxRotatedHeaderSize) continue;
+    if (loop->Contains(term->blocks[0]) == loop->Contains(term->blocks[1])) continue;
+    bool duplicable = true;
+    for (auto inst : header->insts) {
+      if (inst->op == Op::PHI || inst->op == Op::ALLOC || used_outside.count(inst)) duplicable = false;
+    }
+    if (!duplicable) continue;
+    // The header stays in front of the loop as its guard, and every latch that
+    // jumped back to it evaluates a copy of the condition itself, branching
+    // straight to the body or out of the loop.
+    for (auto latch : loop->latches) {
+      if (latch->Terminator()->op != Op::JUMP) continue;
+      latch->insts.pop_back();
+      unordered_map<Value *, Value *> copies;
+      for (auto inst : header->insts) {
+        auto copy = module.NewValue(inst->op, inst->ty);
+        *copy = *inst;
+        copy->parent = latch;
+        for (auto &operand : copy->operands) {
+          auto it = copies.find(operand);
+          if (it != copies.end()) operand = it->second;
+        }
+        copies[inst] = copy;
+        latch->insts.push_back(copy);
+      }
+      changed = true;
+    }
+  }
+  if (changed) BuildCFG(func);
+  return changed;
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include "ir.h"
+
+using namespace std;
+
+BasicBlock *Loop::Preheader() const {
+  BasicBlock *preheader = nullptr;
+  for (auto pred : header->preds) {
+    if (Contains(pred)) continue;
+    if (preheader) return nullptr;
+    preheader = pred;
+  }
+  return preheader && preheader->succs.size() == 1 ? preheader : nullptr;
+}
+
+vector<BasicBlock *> Loop::ExitingBlocks() const {
+  vector<BasicBlock *> exiting;
+  for (auto bb : blocks) {
+    for (auto succ : bb->succs) {
+      if (!Contains(succ)) {
+        exiting.push_back(bb);
+        break;
+      }
+    }
+  }
+  return exiting;
+}
+
+LoopInfo::LoopInfo(Function &func, const DominatorTree &dom) {
+  unordered_map<BasicBlock *, Loop *> by_header;
+  for (auto bb : dom.Order()) {
+    for (auto succ : bb->succs) {
+      if (!dom.Dominates(succ, bb)) continue;
+      auto &loop = by_header[succ];
+      if (!loop) {
+        loops.emplace_back(new Loop());
+        loop = loops.back().get();
+        loop->header = succ;
+        loop->blocks.insert(succ);
+      }
+      loop->latches.push_back(bb);
+      vector<BasicBlock *> work;
+      if (loop->blocks.insert(bb).second) work.push_back(bb);
+      while (!work.empty()) {
+        auto member = work.back();
+        work.pop_back();
+        for (auto pred : member->preds) {
+          if (dom.Reachable(pred) && loop->blocks.insert(pred).second) work.push_back(pred);
+        }
+      }
+    }
+  }
+  // A loop nested in another is strictly smaller, so sorting by size puts the
+  // inner loops first and makes the first enclosing loop found the parent.
+  for (auto &loop : loops) order.push_back(loop.get());
+  stable_sort(order.begin(), order.end(),
+              [](Loop *a, Loop *b) { return a->blocks.size() < b->blocks.size(); });
+  for (size_t i = 0; i < order.size(); ++i) {
+    for (size_t j = i + 1; j < order.size(); ++j) {
+      if (order[j]->Contains(order[i]->header)) {
+        order[i]->parent = order[j];
+        break;
+      }
+    }
+    for (auto bb : order[i]->blocks) innermost.emplace(bb, order[i]);
+  }
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    if ((*it)->parent) (*it)->depth = (*it)->parent->depth + 1;
+  }
+}
+
+Loop *LoopInfo::LoopFor(BasicBlock *bb) const {
+  auto it = innermost.find(bb);
+  return it == innermost.end() ? nullptr : it->second;
+}
+
+static void SplitPreheader(Module &module, Function &func, Loop &loop) {
+  auto header = loop.header;
+  auto preheader = module.NewBlock(&func, header->name + "_preheader");
+  vector<BasicBlock *> outside;
+  for (auto pred : header->preds) {
+    if (!loop.Contains(pred)) outside.push_back(pred);
+  }
+  for (auto pred : outside) {
+    for (auto &target : pred->Terminator()->blocks) {
+      if (target == header) target = preheader;
+    }
+  }
+  // The incoming values from outside the loop now arrive through the
+  // preheader, merged there by a new phi if they came from several blocks.
+  for (auto phi : header->insts) {
+    if (phi->op != Op::PHI) break;
+    auto merged = module.NewPhi(phi->ty);
+    vector<Value *> operands;
+    vector<BasicBlock *> blocks;
+    for (size_t i = 0; i < phi->blocks.size(); ++i) {
+      bool from_outside = !loop.Contains(phi->blocks[i]);
+      (from_outside ? merged->operands : operands).push_back(phi->operands[i]);
+      (from_outside ? merged->blocks : blocks).push_back(phi->blocks[i]);
+    }
+    if (merged->operands.size() == 1) {
+      operands.push_back(merged->operands[0]);
+    } else {
+      merged->parent = preheader;
+      preheader->insts.push_back(merged);
+      operands.push_back(merged);
+    }
+    blocks.push_back(preheader);
+    phi->operands.swap(operands);
+    phi->blocks.swap(blocks);
+  }
+  auto jump = module.NewJump(header);
+  jump->parent = preheader;
+  preheader->insts.push_back(jump);
+  func.blocks.push_back(preheader);
+}
+
+bool InsertPreheaders(Module &module, Function &func) {
+  RemoveUnreachableBlocks(func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  bool changed = false;
+  for (auto loop : loops.Loops()) {
+    // A loop headed by the entry is entered without an edge to split.
+    if (loop->header == func.Entry() || loop->Preheader()) continue;
+    SplitPreheader(module, func, *loop);
+    changed = true;
+  }
+  if (changed) BuildCFG(func);
+  return changed;
+}
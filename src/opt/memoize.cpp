@@ -0,0 +1,127 @@
+#include <algorithm>
+#include "passes.h"
+
+using namespace std;
+
+// Every memo table holds this many entries of the arguments and the result.
+static const int kMemoEntries = 4096;
+// Multiplier combining the arguments into a hash.
+static const int kHashMultiplier = 1009;
+
+// Whether func may call itself more than once per call, so that results get
+// computed over and over: one invocation may run two calls into its component,
+// one after the other on some path, or one from within a loop. Calls on
+// exclusive branches run once at most.
+static bool RecursesRepeatedly(Function &func, const vector<Function *> &scc) {
+  BuildCFG(func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  vector<BasicBlock *> call_blocks;
+  for (auto bb : func.blocks) {
+    int calls = 0;
+    for (auto inst : bb->insts) {
+      if (inst->op != Op::CALL || find(scc.begin(), scc.end(), inst->callee) == scc.end()) continue;
+      if (++calls > 1 || loops.LoopFor(bb)) return true;
+    }
+    if (calls) call_blocks.push_back(bb);
+  }
+  // Outside loops, a block with a call reaching another one.
+  for (auto from : call_blocks) {
+    unordered_set<BasicBlock *> seen;
+    vector<BasicBlock *> work(from->succs.begin(), from->succs.end());
+    while (!work.empty()) {
+      auto bb = work.back();
+      work.pop_back();
+      if (!seen.insert(bb).second) continue;
+      if (find(call_blocks.begin(), call_blocks.end(), bb) != call_blocks.end()) return true;
+      work.insert(work.end(), bb->succs.begin(), bb->succs.end());
+    }
+  }
+  return false;
+}
+
+// Puts a lookup in front of the body of func, which returns the remembered
+// result if the table entry for the hash of the arguments holds them, and
+// records the arguments and the result at every return:
+//
+//   entry:  entry = memo + (hash % (N / 2) + N / 2) * (args + 2)
+//           br entry[0] && entry[1] == arg0 && ..., hit, body
+//   hit:    ret entry[args + 1]
+//   body:   the old entry; every ret stores 1, the args and the result
+//
+// The remainder takes the sign of the hash, so adding half the table size
+// maps every hash into it without a second division.
+static void Memoize(Module &module, Function &func) {
+  int stride = (int)func.args.size() + 2;
+  auto table = module.NewGlobal("memo_" + func.name, Type::Array(Type::Int32(), kMemoEntries * stride));
+  auto body = func.Entry();
+  auto entry = module.NewBlock(&func, "entry");
+  auto hit = module.NewBlock(&func, "memo_hit");
+  body->name = "memo_miss";
+  auto allocs = stable_partition(body->insts.begin(), body->insts.end(),
+                                 [](Value *inst) { return inst->op == Op::ALLOC; });
+  for (auto it = body->insts.begin(); it != allocs; ++it) {
+    (*it)->parent = entry;
+    entry->insts.push_back(*it);
+  }
+  body->insts.erase(body->insts.begin(), allocs);
+  auto add = [&](BasicBlock *bb, Value *inst) {
+    inst->parent = bb;
+    bb->insts.push_back(inst);
+    return inst;
+  };
+
+  Value *hash = func.args[0];
+  for (size_t i = 1; i < func.args.size(); ++i) {
+    auto scaled = add(entry, module.NewBinary(BinOp::MUL, hash, module.Const(kHashMultiplier)));
+    hash = add(entry, module.NewBinary(BinOp::ADD, scaled, func.args[i]));
+  }
+  auto rem = add(entry, module.NewBinary(BinOp::MOD, hash, module.Const(kMemoEntries / 2)));
+  auto index = add(entry, module.NewBinary(BinOp::ADD, rem, module.Const(kMemoEntries / 2)));
+  auto offset = add(entry, module.NewBinary(BinOp::MUL, index, module.Const(stride)));
+  auto record = add(entry, module.NewValue(Op::GET_ELEM_PTR, Type::Pointer(Type::Int32())));
+  record->operands = {table, offset};
+  auto field = [&](BasicBlock *bb, int i) {
+    if (i == 0) return record;
+    auto ptr = add(bb, module.NewValue(Op::GET_PTR, record->ty));
+    ptr->operands = {record, module.Const(i)};
+    return ptr;
+  };
+  Value *found = add(entry, module.NewLoad(record));
+  for (size_t i = 0; i < func.args.size(); ++i) {
+    auto key = add(entry, module.NewLoad(field(entry, (int)i + 1)));
+    auto same = add(entry, module.NewBinary(BinOp::EQ, key, func.args[i]));
+    found = add(entry, module.NewBinary(BinOp::AND, found, same));
+  }
+  add(entry, module.NewBranch(found, hit, body));
+  auto remembered = add(hit, module.NewLoad(field(hit, stride - 1)));
+  auto ret = add(hit, module.NewValue(Op::RETURN, Type::Unit()));
+  ret->operands = {remembered};
+
+  for (auto bb : func.blocks) {
+    auto term = bb->Terminator();
+    if (term->op != Op::RETURN) continue;
+    bb->insts.pop_back();
+    add(bb, module.NewStore(module.Const(1), record));
+    for (size_t i = 0; i < func.args.size(); ++i) add(bb, module.NewStore(func.args[i], field(bb, (int)i + 1)));
+    add(bb, module.NewStore(term->operands[0], field(bb, stride - 1)));
+    add(bb, term);
+  }
+  func.blocks.insert(func.blocks.begin(), entry);
+  func.blocks.push_back(hit);
+  BuildCFG(func);
+}
+
+bool MemoizeFunctions(Module &module) {
+  bool changed = false;
+  for (const auto &scc : CallGraphSCCs(module)) {
+    for (auto func : scc) {
+      if (!func->pure || func->norecurse || func->ret_ty != Type::Int32() || func->args.empty()) continue;
+      bool int_args = all_of(func->args.begin(), func->args.end(), [](Value *arg) { return arg->ty == Type::Int32(); });
+      if (!int_args || !RecursesRepeatedly(*func, scc)) continue;
+      Memoize(module, *func);
+      changed = true;
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include "ir.h"
+
+// Transforms of the pipeline that only pay off for some programs, all off
+// unless asked for on the command line.
+struct OptimizeOptions {
+  // -fmemoize: MemoizeFunctions, which adds a table and a lookup per call.
+  bool memoize = false;
+};
+
+// Parses a Koopa IR program, runs the optimization pipeline over it and
+// returns the optimized program as Koopa IR text. The names of the globals it
+// finds the program never writes are added to readonly_globals.
+std::string OptimizeKoopa(const std::string &ir, const OptimizeOptions &options,
+                          std::unordered_set<std::string> &readonly_globals);
+
+// Rotates while loops whose condition fits in the header block: the header
+// becomes a guard in front of the loop and each latch tests a copy of the
+// condition, so an iteration takes one conditional branch instead of a jump
+// back plus a branch. Runs before PromoteAllocs, while the condition still
+// reads its variables from memory.
+bool RotateLoops(Module &module, Function &func);
+
+// Turns calls of func to itself whose result it returns right away into
+// jumps back to its start, with phis there taking the new arguments. So are
+// calls whose result is returned after adding or multiplying it with another
+// value: an accumulator phi collects those operands, and the other returns
+// apply it to their value. In functions returning only 0 or 1, a call that
+// && or || merely compare against 0 counts as returned right away. Calls
+// passing the address of a local are left alone.
+bool EliminateTailRecursion(Module &module, Function &func);
+
+// Marks the globals nothing stores to, or hands to a call that may write
+// memory, as constant, and replaces the loads of their elements at constant
+// offsets by the initial values. Those left unread are removed.
+bool FoldConstantGlobals(Module &module);
+
+// Runs calls of pure functions on constant arguments in an interpreter and
+// replaces them by their results. Calls that would trap, or take too many
+// steps, too much memory or too deep a recursion to evaluate, stay, and are
+// not tried again with the same arguments. So do all calls once the steps
+// allowed for the whole module are spent.
+bool EvaluateConstantCalls(Module &module);
+
+// Gives recursive functions that only compute on their int arguments, and
+// may call themselves several times per call, a table of remembered results
+// indexed by a hash of the arguments. A new result replaces whatever its
+// entry held before.
+bool MemoizeFunctions(Module &module);
+
+// Inlines calls to small functions, following the call graph bottom-up. The
+// size threshold grows with the loop depth of the call and its constant
+// arguments; the only call of a function is inlined up to a much larger size.
+// Calls within a cycle of the call graph are never inlined. Functions left
+// without callers are removed.
+bool InlineFunctions(Module &module);
+
+// Interprocedural sparse conditional constant propagation from main:
+// replaces the arguments that every executable call passes the same constant,
+// the results of calls to functions that always return the same constant, and
+// whatever folds from them, skipping code no executable edge reaches.
+bool PropagateConstants(Module &module);
+// Makes copies of functions called from loops with constant arguments, with
+// those arguments replaced by the constants, when they feed computations that
+// may fold. Calls with the same constants share a copy; the copies are bounded
+// by a code-growth budget. Functions left without callers are removed.
+bool SpecializeFunctions(Module &module);
+
+// Drops the parameters of functions other than main that nothing reads, and
+// their results when no call uses them, along with the matching arguments
+// and results at every call. Values only passed on to such parameters or
+// returned as such results, as recursive functions do, count as unused.
+bool EliminateDeadArguments(Module &module);
+// Turns scalar globals that only main loads and stores into locals of main,
+// initialized on entry, provided main never runs twice at once.
+bool LocalizeGlobals(Module &module);
+
+// Promotes scalar allocs that are only loaded and stored into SSA values.
+void PromoteAllocs(Module &module, Function &func);
+// Turns every phi back into an alloc, stored in the predecessors and loaded
+// in place of the phi, since the printed IR carries no block arguments.
+void LowerPhis(Module &module, Function &func);
+
+// Walks the dominator tree numbering arithmetic, address computations and
+// loads, and replaces each one by an equivalent value computed in a dominator.
+// Also folds constants and algebraic identities. Loads are reused, and stores
+// forwarded to later loads, until an aliasing store or a call intervenes.
+bool GlobalValueNumbering(Module &module, Function &func);
+
+// Moves loop-invariant arithmetic, address computations and loads into the
+// preheaders of the loops containing them, inner loops first. A load moves
+// only if no store or call in the loop may write its address, and only if it
+// cannot fault or would have run anyway.
+bool LoopInvariantCodeMotion(Module &module, Function &func);
+// Keeps scalar globals a loop writes in SSA values while it runs: loads them
+// in the preheader and stores them back on every exit edge. Only globals the
+// loop accesses by name alone, and no call in it may touch, qualify.
+bool PromoteGlobals(Module &module, Function &func);
+
+// Strength-reduces addresses indexed by an affine function of a basic
+// induction variable, a[c * i + k], into pointers of their own that start in
+// the preheader and advance by a constant each iteration, so the loop no
+// longer multiplies to compute them.
+bool ReduceInductionVariables(Module &module, Function &func);
+
+// Unrolls loops made of a single block that count an induction variable
+// towards a loop-invariant bound. Loops with a small constant trip count are
+// replaced by straight-line copies of their body; loops counting up by one
+// run several copies per trip of a new loop while enough iterations remain,
+// and finish in the original loop. Both are bounded by a code-size budget.
+bool UnrollLoops(Module &module, Function &func);
+
+// Removes instructions whose results are unused and that have no side effects.
+bool EliminateDeadCode(Function &func);
+// Marks what is needed to compute the observable behaviour of func, following
+// data and control dependence, and deletes everything else: dead instructions,
+// stores to locals that are never read, and branches (hence whole blocks and
+// loops) that nothing live depends on.
+bool AggressiveDCE(Module &module, Function &func);
+// Folds constant branches, merges straight-line blocks, bypasses empty blocks
+// and drops unreachable ones.
+bool SimplifyCFG(Module &module, Function &func);
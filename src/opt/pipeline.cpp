@@ -0,0 +1,70 @@
+#include <cassert>
+#include "passes.h"
+
+using namespace std;
+
+// Brings a function straight out of the frontend into SSA form and cleans
+// it up, before the interprocedural passes look at it.
+static void Canonicalize(Module &module, Function &func) {
+  RotateLoops(module, func);
+  PromoteAllocs(module, func);
+  GlobalValueNumbering(module, func);
+  SimplifyCFG(module, func);
+  if (EliminateTailRecursion(module, func)) SimplifyCFG(module, func);
+  EliminateDeadCode(func);
+}
+
+static void OptimizeFunction(Module &module, Function &func) {
+  GlobalValueNumbering(module, func);
+  SimplifyCFG(module, func);
+  EliminateDeadCode(func);
+  AggressiveDCE(module, func);
+  SimplifyCFG(module, func);
+  LoopInvariantCodeMotion(module, func);
+  PromoteGlobals(module, func);
+  ReduceInductionVariables(module, func);
+  GlobalValueNumbering(module, func);
+  EliminateDeadCode(func);
+  SimplifyCFG(module, func);
+  if (UnrollLoops(module, func)) {
+    GlobalValueNumbering(module, func);
+    SimplifyCFG(module, func);
+    EliminateDeadCode(func);
+  }
+  LowerPhis(module, func);
+}
+
+string OptimizeKoopa(const string &ir, const OptimizeOptions &options, unordered_set<string> &readonly_globals) {
+  koopa_program_t program;
+  koopa_error_code_t ret = koopa_parse_from_string(ir.c_str(), &program);
+  assert(ret == KOOPA_EC_SUCCESS);
+  koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+  koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
+  koopa_delete_program(program);
+  auto module = BuildModule(raw);
+  koopa_delete_raw_program_builder(builder);
+
+  for (auto func : module->functions) {
+    if (!func->IsDeclaration()) Canonicalize(*module, *func);
+  }
+  InferAttributes(*module);
+  // Reading constant globals leaves a function pure.
+  if (FoldConstantGlobals(*module)) InferAttributes(*module);
+  EvaluateConstantCalls(*module);
+  // Memoized functions write their tables.
+  if (options.memoize && MemoizeFunctions(*module)) InferAttributes(*module);
+  InlineFunctions(*module);
+  PropagateConstants(*module);
+  if (SpecializeFunctions(*module)) PropagateConstants(*module);
+  EliminateDeadArguments(*module);
+  LocalizeGlobals(*module);
+  // Inlining leaves callers doing less, and the copies start out unknown.
+  InferAttributes(*module);
+  for (auto func : module->functions) {
+    if (!func->IsDeclaration()) OptimizeFunction(*module, *func);
+  }
+  for (auto global : module->globals) {
+    if (global->constant) readonly_globals.insert(global->name);
+  }
+  return PrintModule(*module);
+}
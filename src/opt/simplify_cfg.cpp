@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <unordered_set>
+#include "passes.h"
+
+using namespace std;
+
+// Replaces the edge pred -> old_succ by pred -> new_succ, where old_succ only
+// jumps to new_succ. The phis of new_succ take for pred what they took for
+// old_succ.
+static void RedirectEdge(BasicBlock *pred, BasicBlock *old_succ, BasicBlock *new_succ) {
+  for (auto &target : pred->Terminator()->blocks) {
+    if (target == old_succ) target = new_succ;
+  }
+  for (auto phi : new_succ->insts) {
+    if (phi->op != Op::PHI) break;
+    phi->operands.push_back(PhiIncoming(phi, old_succ));
+    phi->blocks.push_back(pred);
+  }
+}
+
+static bool FoldBranches(Module &module, Function &func) {
+  bool changed = false;
+  for (auto bb : func.blocks) {
+    auto term = bb->Terminator();
+    if (term->op != Op::BRANCH) continue;
+    BasicBlock *target = nullptr;
+    if (term->blocks[0] == term->blocks[1]) {
+      target = term->blocks[0];
+    } else if (term->operands[0]->IsConst()) {
+      target = term->blocks[term->operands[0]->imm ? 0 : 1];
+      RemovePhiIncoming(term->blocks[term->operands[0]->imm ? 1 : 0], bb);
+    } else {
+      continue;
+    }
+    auto jump = module.NewJump(target);
+    jump->parent = bb;
+    bb->insts.back() = jump;
+    changed = true;
+  }
+  return changed;
+}
+
+// Folds phis that have a single incoming value or whose operands all agree.
+static bool FoldTrivialPhis(Function &func) {
+  unordered_map<Value *, Value *> replace;
+  for (auto bb : func.blocks) {
+    vector<Value *> kept;
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::PHI) {
+        Value *same = nullptr;
+        bool trivial = true;
+        for (auto operand : inst->operands) {
+          if (operand == inst || operand == same) continue;
+          if (same) {
+            trivial = false;
+            break;
+          }
+          same = operand;
+        }
+        if (trivial && same) {
+          replace[inst] = same;
+          continue;
+        }
+      }
+      kept.push_back(inst);
+    }
+    bb->insts.swap(kept);
+  }
+  ReplaceUses(func, replace);
+  return !replace.empty();
+}
+
+// Appends bb to its only predecessor when that predecessor always jumps to it.
+static bool MergeBlocks(Function &func) {
+  bool changed = false;
+  unordered_set<BasicBlock *> removed;
+  for (auto bb : func.blocks) {
+    if (removed.count(bb) || bb == func.Entry() || bb->preds.size() != 1) continue;
+    auto pred = bb->preds[0];
+    if (pred == bb || pred->Terminator()->op != Op::JUMP || bb->insts[0]->op == Op::PHI) continue;
+    pred->insts.pop_back();
+    for (auto inst : bb->insts) {
+      inst->parent = pred;
+      pred->insts.push_back(inst);
+    }
+    for (auto succ : bb->succs) {
+      for (auto phi : succ->insts) {
+        if (phi->op != Op::PHI) break;
+        replace(phi->blocks.begin(), phi->blocks.end(), bb, pred);
+      }
+    }
+    pred->succs = bb->succs;
+    for (auto succ : bb->succs) replace(succ->preds.begin(), succ->preds.end(), bb, pred);
+    removed.insert(bb);
+    changed = true;
+  }
+  if (changed) {
+    func.blocks.erase(remove_if(func.blocks.begin(), func.blocks.end(),
+                                [&](BasicBlock *bb) { return removed.count(bb); }),
+                      func.blocks.end());
+  }
+  return changed;
+}
+
+// Lets the predecessors of a block holding nothing but a jump go straight to
+// its target, unless a phi there would have to tell them apart.
+static bool BypassEmptyBlocks(Function &func) {
+  bool changed = false;
+  for (auto bb : func.blocks) {
+    if (bb == func.Entry() || bb->insts.size() != 1 || bb->Terminator()->op != Op::JUMP) continue;
+    auto target = bb->Terminator()->blocks[0];
+    if (target == bb) continue;
+    bool has_phi = target->insts[0]->op == Op::PHI, redirected = false;
+    for (auto pred : vector<BasicBlock *>(bb->preds)) {
+      if (has_phi && find(target->preds.begin(), target->preds.end(), pred) != target->preds.end()) continue;
+      RedirectEdge(pred, bb, target);
+      redirected = true;
+    }
+    if (redirected) {
+      BuildCFG(func);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool SimplifyCFG(Module &module, Function &func) {
+  bool changed = false;
+  for (bool again = true; again;) {
+    again = FoldBranches(module, func);
+    again |= RemoveUnreachableBlocks(func);
+    again |= FoldTrivialPhis(func);
+    again |= BypassEmptyBlocks(func);
+    again |= RemoveUnreachableBlocks(func);
+    again |= MergeBlocks(func);
+    BuildCFG(func);
+    changed |= again;
+  }
+  return changed;
+}
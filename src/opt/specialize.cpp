@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <map>
+#include "passes.h"
+
+using namespace std;
+
+// Only functions of at most this many instructions are specialized, and the
+// copies made may add up to at most this many instructions in total.
+static const int kMaxSpecializedSize = 200;
+static const int kSpecializationBudget = 1000;
+
+static int Size(const Function &func) {
+  int size = 0;
+  for (auto bb : func.blocks) size += (int)bb->insts.size();
+  return size;
+}
+
+// Whether knowing arg lets the code using it fold something: it is compared,
+// multiplied, divided or indexes an address, rather than just passed along.
+static bool FoldsWhenConstant(const Function &func, Value *arg) {
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (find(inst->operands.begin(), inst->operands.end(), arg) == inst->operands.end()) continue;
+      if (inst->op == Op::GET_PTR || inst->op == Op::GET_ELEM_PTR) return true;
+      if (inst->op == Op::BINARY && inst->binop != BinOp::ADD && inst->binop != BinOp::SUB) return true;
+    }
+  }
+  return false;
+}
+
+// A copy of func under a new name, with the arguments that have a value in
+// constants replaced by it. The copy keeps all the parameters.
+static Function *CloneFunction(Module &module, Function &func, const vector<Value *> &constants) {
+  auto clone = module.NewFunction(module.UniqueName(func.name + "_spec"), func.ret_ty);
+  unordered_map<Value *, Value *> values;
+  unordered_map<BasicBlock *, BasicBlock *> blocks;
+  for (size_t i = 0; i < func.args.size(); ++i) {
+    auto arg = module.NewValue(Op::ARG, func.args[i]->ty);
+    arg->imm = func.args[i]->imm;
+    arg->name = func.args[i]->name;
+    clone->args.push_back(arg);
+    values[func.args[i]] = constants[i] ? constants[i] : arg;
+  }
+  for (auto bb : func.blocks) {
+    auto copy = module.NewBlock(clone, bb->name);
+    blocks[bb] = copy;
+    clone->blocks.push_back(copy);
+    for (auto inst : bb->insts) {
+      auto inst_copy = module.NewValue(inst->op, inst->ty);
+      *inst_copy = *inst;
+      inst_copy->parent = copy;
+      copy->insts.push_back(inst_copy);
+      values[inst] = inst_copy;
+    }
+  }
+  for (auto bb : clone->blocks) {
+    for (auto inst : bb->insts) {
+      for (auto &operand : inst->operands) {
+        auto it = values.find(operand);
+        if (it != values.end()) operand = it->second;
+      }
+      for (auto &target : inst->blocks) target = blocks.at(target);
+    }
+  }
+  BuildCFG(*clone);
+  return clone;
+}
+
+bool SpecializeFunctions(Module &module) {
+  // Copies made so far, by function and the constants given to its arguments.
+  map<pair<Function *, vector<Value *>>, Function *> clones;
+  int budget = kSpecializationBudget;
+  bool changed = false;
+  auto funcs = module.functions;
+  for (auto func : funcs) {
+    if (func->IsDeclaration()) continue;
+    BuildCFG(*func);
+    DominatorTree dom(*func);
+    LoopInfo loops(*func, dom);
+    for (auto bb : func->blocks) {
+      // Only calls in loops are worth a copy of their own.
+      if (!loops.LoopFor(bb)) continue;
+      for (auto call : bb->insts) {
+        if (call->op != Op::CALL || call->callee->IsDeclaration() || call->callee->name == "main") continue;
+        auto callee = call->callee;
+        vector<Value *> constants(call->operands.size(), nullptr);
+        bool useful = false;
+        for (size_t i = 0; i < call->operands.size(); ++i) {
+          if (!call->operands[i]->IsConst() || !FoldsWhenConstant(*callee, callee->args[i])) continue;
+          constants[i] = call->operands[i];
+          useful = true;
+        }
+        if (!useful) continue;
+        auto &clone = clones[{callee, constants}];
+        if (!clone) {
+          int size = Size(*callee);
+          if (size > kMaxSpecializedSize || size > budget) {
+            clones.erase({callee, constants});
+            continue;
+          }
+          budget -= size;
+          clone = CloneFunction(module, *callee, constants);
+          module.functions.insert(find(module.functions.begin(), module.functions.end(), callee) + 1, clone);
+          // Recursive calls passing the same constants along stay in the copy.
+          for (auto clone_bb : clone->blocks) {
+            for (auto inst : clone_bb->insts) {
+              if (inst->op != Op::CALL || inst->callee != callee) continue;
+              bool same = true;
+              for (size_t i = 0; i < constants.size(); ++i) same &= !constants[i] || inst->operands[i] == constants[i];
+              if (same) inst->callee = clone;
+            }
+          }
+        }
+        call->callee = clone;
+        changed = true;
+      }
+    }
+  }
+  if (changed) RemoveUncalledFunctions(module);
+  return changed;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include "passes.h"
+
+using namespace std;
+
+void PromoteAllocs(Module &module, Function &func) {
+  unordered_map<Value *, int> slot;
+  vector<Value *> allocs;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (inst->op == Op::ALLOC && inst->ty->base->tag != Type::ARRAY) {
+        slot[inst] = (int)allocs.size();
+        allocs.push_back(inst);
+      }
+    }
+  }
+  unordered_set<Value *> escaped;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      for (size_t i = 0; i < inst->operands.size(); ++i) {
+        auto operand = inst->operands[i];
+        if (!slot.count(operand)) continue;
+        bool plain = (inst->op == Op::LOAD && i == 0) || (inst->op == Op::STORE && i == 1);
+        if (!plain) escaped.insert(operand);
+      }
+    }
+  }
+  allocs.erase(remove_if(allocs.begin(), allocs.end(), [&](Value *alloc) { return escaped.count(alloc); }),
+               allocs.end());
+  if (allocs.empty()) return;
+  slot.clear();
+  for (size_t i = 0; i < allocs.size(); ++i) slot[allocs[i]] = (int)i;
+
+  RemoveUnreachableBlocks(func);
+  DominatorTree dom(func);
+  auto frontiers = dom.Frontiers();
+
+  // Place phis at the iterated dominance frontier of the stores.
+  unordered_map<Value *, int> phi_slot;
+  for (size_t i = 0; i < allocs.size(); ++i) {
+    vector<BasicBlock *> work;
+    unordered_set<BasicBlock *> has_phi, queued;
+    for (auto bb : func.blocks) {
+      for (auto inst : bb->insts) {
+        if (inst->op == Op::STORE && inst->operands[1] == allocs[i] && queued.insert(bb).second) {
+          work.push_back(bb);
+        }
+      }
+    }
+    while (!work.empty()) {
+      auto bb = work.back();
+      work.pop_back();
+      for (auto df : frontiers[bb]) {
+        if (!has_phi.insert(df).second) continue;
+        auto phi = module.NewPhi(allocs[i]->ty->base);
+        phi->parent = df;
+        df->insts.insert(df->insts.begin(), phi);
+        phi_slot[phi] = (int)i;
+        if (queued.insert(df).second) work.push_back(df);
+      }
+    }
+  }
+
+  unordered_map<Value *, Value *> replace;
+  auto resolve = [&](Value *value) {
+    for (auto it = replace.find(value); it != replace.end(); it = replace.find(value)) value = it->second;
+    return value;
+  };
+  vector<vector<Value *>> current(allocs.size());
+  auto top = [&](int i) { return current[i].empty() ? module.Undef() : current[i].back(); };
+  function<void(BasicBlock *)> rename = [&](BasicBlock *bb) {
+    vector<int> pushed;
+    vector<Value *> kept;
+    for (auto inst : bb->insts) {
+      auto it = phi_slot.find(inst);
+      if (it != phi_slot.end()) {
+        current[it->second].push_back(inst);
+        pushed.push_back(it->second);
+      } else if (inst->op == Op::LOAD && slot.count(inst->operands[0])) {
+        replace[inst] = top(slot[inst->operands[0]]);
+        continue;
+      } else if (inst->op == Op::STORE && slot.count(inst->operands[1])) {
+        int i = slot[inst->operands[1]];
+        current[i].push_back(resolve(inst->operands[0]));
+        pushed.push_back(i);
+        continue;
+      } else if (inst->op == Op::ALLOC && slot.count(inst)) {
+        continue;
+      }
+      kept.push_back(inst);
+    }
+    bb->insts.swap(kept);
+    for (auto succ : bb->succs) {
+      for (auto inst : succ->insts) {
+        if (inst->op != Op::PHI) break;
+        auto it = phi_slot.find(inst);
+        if (it == phi_slot.end()) continue;
+        inst->operands.push_back(top(it->second));
+        inst->blocks.push_back(bb);
+      }
+    }
+    for (auto child : dom.Children(bb)) rename(child);
+    for (int i : pushed) current[i].pop_back();
+  };
+  rename(func.Entry());
+  ReplaceUses(func, replace);
+}
+
+void LowerPhis(Module &module, Function &func) {
+  vector<Value *> phis;
+  for (auto bb : func.blocks) {
+    for (auto inst : bb->insts) {
+      if (inst->op != Op::PHI) break;
+      phis.push_back(inst);
+    }
+  }
+  auto entry = func.Entry();
+  vector<Value *> slots;
+  for (auto phi : phis) {
+    auto slot = module.NewValue(Op::ALLOC, Type::Pointer(phi->ty));
+    slot->name = "phi";
+    slot->parent = entry;
+    slots.push_back(slot);
+    for (size_t i = 0; i < phi->operands.size(); ++i) {
+      if (phi->operands[i]->op == Op::UNDEF) continue;
+      phi->blocks[i]->InsertBeforeTerminator(module.NewStore(phi->operands[i], slot));
+    }
+    // Reuse the phi itself as the load so that its users need no rewriting.
+    phi->op = Op::LOAD;
+    phi->operands = {slot};
+    phi->blocks.clear();
+  }
+  entry->insts.insert(entry->insts.begin(), slots.begin(), slots.end());
+}
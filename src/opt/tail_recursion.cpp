@@ -0,0 +1,216 @@
+#include <algorithm>
+#include "passes.h"
+
+using namespace std;
+
+// Whether test compares call against 0.
+static bool IsZeroTest(Value *test, Value *call) {
+  if (test->op != Op::BINARY || test->binop != BinOp::NOT_EQ) return false;
+  auto lhs = test->operands[0], rhs = test->operands[1];
+  return (lhs == call && rhs->IsConst() && rhs->imm == 0) || (rhs == call && lhs->IsConst() && lhs->imm == 0);
+}
+
+// The call of func itself that bb ends with, if bb returns its result right
+// away: either directly, or by jumping to a block that does nothing but return
+// it, possibly through a phi. Null otherwise. If boolean, func only returns 0
+// or 1, so the result may also be compared against 0 first, as && and || do
+// with their right operand; test then receives the comparison.
+static Value *TailCall(Function &func, BasicBlock *bb, bool boolean, Value **test) {
+  *test = nullptr;
+  if (bb->insts.size() < 2) return nullptr;
+  auto term = bb->Terminator();
+  auto call = bb->insts[bb->insts.size() - 2];
+  if (boolean && bb->insts.size() >= 3 && IsZeroTest(call, bb->insts[bb->insts.size() - 3])) {
+    *test = call;
+    call = bb->insts[bb->insts.size() - 3];
+  }
+  if (call->op != Op::CALL || call->callee != &func) return nullptr;
+  // The arguments are reused by the next iteration, so none may point into
+  // the frame of this one.
+  for (auto arg : call->operands) {
+    if (LocalRoot(arg)) return nullptr;
+  }
+  Value *ret = term, *result = *test ? *test : call->HasResult() ? call : nullptr;
+  if (term->op == Op::JUMP) {
+    auto target = term->blocks[0];
+    ret = target->Terminator();
+    if (target->insts.size() == 2 && target->insts[0]->op == Op::PHI && PhiIncoming(target->insts[0], bb) == result) {
+      result = target->insts[0];
+    } else if (target->insts.size() != 1) {
+      return nullptr;
+    }
+  }
+  if (ret->op != Op::RETURN) return nullptr;
+  auto returned = ret->operands.empty() ? nullptr : ret->operands[0];
+  return returned == result ? call : nullptr;
+}
+
+// The call of func itself in bb if bb returns its result combined with some
+// other value through an addition or multiplication, which combine receives;
+// null otherwise. In between there may only be arithmetic and address
+// computations not using the result, which can as well run before the call.
+static Value *AccumulatorCall(Function &func, BasicBlock *bb, Value **combine) {
+  if (bb->insts.size() < 3) return nullptr;
+  auto ret = bb->Terminator();
+  auto binary = bb->insts[bb->insts.size() - 2];
+  if (ret->op != Op::RETURN || ret->operands.empty() || ret->operands[0] != binary || binary->op != Op::BINARY) {
+    return nullptr;
+  }
+  if (binary->binop != BinOp::ADD && binary->binop != BinOp::MUL) return nullptr;
+  if (binary->operands[0] == binary->operands[1]) return nullptr;
+  for (auto call : binary->operands) {
+    if (call->op != Op::CALL || call->callee != &func || call->parent != bb) continue;
+    bool movable = true;
+    for (auto it = bb->insts.end() - 3; movable && *it != call; --it) {
+      auto inst = *it;
+      movable = (inst->op == Op::BINARY || inst->op == Op::GET_PTR || inst->op == Op::GET_ELEM_PTR) &&
+                find(inst->operands.begin(), inst->operands.end(), call) == inst->operands.end();
+    }
+    for (auto arg : call->operands) {
+      if (LocalRoot(arg)) movable = false;
+    }
+    if (!movable) continue;
+    *combine = binary;
+    return call;
+  }
+  return nullptr;
+}
+
+// Whether value is 0 or 1, given that the calls of func return 0 or 1.
+static bool IsBoolean(Function &func, Value *value, unordered_set<Value *> &seen) {
+  if (value->IsConst()) return value->imm == 0 || value->imm == 1;
+  if (value->op == Op::CALL) return value->callee == &func;
+  if (value->op == Op::PHI) {
+    if (!seen.insert(value).second) return true;
+    return all_of(value->operands.begin(), value->operands.end(),
+                  [&](Value *operand) { return IsBoolean(func, operand, seen); });
+  }
+  if (value->op != Op::BINARY) return false;
+  switch (value->binop) {
+    case BinOp::NOT_EQ: case BinOp::EQ: case BinOp::GT: case BinOp::LT: case BinOp::GE: case BinOp::LE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether func returns 0 or 1 only: every return does, supposing the calls
+// of func themselves do, which holds by induction over the recursion.
+static bool ReturnsBoolean(Function &func) {
+  if (func.ret_ty != Type::Int32()) return false;
+  unordered_set<Value *> seen;
+  for (auto bb : func.blocks) {
+    auto term = bb->Terminator();
+    if (term->op == Op::RETURN && !IsBoolean(func, term->operands[0], seen)) return false;
+  }
+  return true;
+}
+
+bool EliminateTailRecursion(Module &module, Function &func) {
+  auto header = func.Entry();
+  BuildCFG(func);
+  if (!header->preds.empty()) return false;
+  // Each call, with the operation applying its pending work to the result,
+  // or null for plain tail calls.
+  vector<pair<Value *, Value *>> calls;
+  // The comparisons of tail calls against 0, which go with them.
+  unordered_set<Value *> tests;
+  bool accumulates = false;
+  BinOp op = BinOp::ADD;
+  bool boolean = ReturnsBoolean(func);
+  for (auto bb : func.blocks) {
+    Value *combine = nullptr, *test = nullptr;
+    if (auto call = TailCall(func, bb, boolean, &test)) {
+      calls.emplace_back(call, nullptr);
+      if (test) tests.insert(test);
+    } else if (auto call = AccumulatorCall(func, bb, &combine)) {
+      if (accumulates && combine->binop != op) continue;
+      accumulates = true;
+      op = combine->binop;
+      calls.emplace_back(call, combine);
+    }
+  }
+  if (calls.empty()) return false;
+
+  // The body becomes a loop: a new entry holds the allocs and jumps to the
+  // old one, where phis pick the arguments of the current iteration and,
+  // for calls whose result is combined with something, the accumulated
+  // operand of the pending operations, starting from their identity.
+  auto entry = module.NewBlock(&func, "entry");
+  header->name = "tail_recursion";
+  auto allocs = stable_partition(header->insts.begin(), header->insts.end(),
+                                 [](Value *inst) { return inst->op == Op::ALLOC; });
+  for (auto it = header->insts.begin(); it != allocs; ++it) {
+    (*it)->parent = entry;
+    entry->insts.push_back(*it);
+  }
+  header->insts.erase(header->insts.begin(), allocs);
+  auto jump = module.NewJump(header);
+  jump->parent = entry;
+  entry->insts.push_back(jump);
+  func.blocks.insert(func.blocks.begin(), entry);
+
+  unordered_map<Value *, Value *> params;
+  vector<Value *> phis;
+  for (auto arg : func.args) {
+    auto phi = module.NewPhi(arg->ty);
+    phi->parent = header;
+    phis.push_back(phi);
+    params[arg] = phi;
+  }
+  header->insts.insert(header->insts.begin(), phis.begin(), phis.end());
+  ReplaceUses(func, params);
+  for (size_t i = 0; i < phis.size(); ++i) {
+    phis[i]->operands.push_back(func.args[i]);
+    phis[i]->blocks.push_back(entry);
+  }
+  Value *acc = nullptr;
+  if (accumulates) {
+    acc = module.NewPhi(func.ret_ty);
+    acc->parent = header;
+    acc->operands.push_back(module.Const(op == BinOp::MUL ? 1 : 0));
+    acc->blocks.push_back(entry);
+    header->insts.insert(header->insts.begin() + phis.size(), acc);
+  }
+
+  for (const auto &site : calls) {
+    auto call = site.first, combine = site.second;
+    auto bb = call->parent;
+    auto term = bb->Terminator();
+    if (term->op == Op::JUMP) RemovePhiIncoming(term->blocks[0], bb);
+    for (size_t i = 0; i < phis.size(); ++i) {
+      phis[i]->operands.push_back(call->operands[i]);
+      phis[i]->blocks.push_back(bb);
+    }
+    bb->insts.erase(remove_if(bb->insts.begin(), bb->insts.end(),
+                              [&](Value *inst) {
+                                return inst == call || inst == combine || inst == term || tests.count(inst);
+                              }),
+                    bb->insts.end());
+    if (acc) {
+      auto next = acc;
+      if (combine) {
+        next = module.NewBinary(op, acc, combine->operands[combine->operands[0] == call ? 1 : 0]);
+        next->parent = bb;
+        bb->insts.push_back(next);
+      }
+      acc->operands.push_back(next);
+      acc->blocks.push_back(bb);
+    }
+    auto back = module.NewJump(header);
+    back->parent = bb;
+    bb->insts.push_back(back);
+  }
+  // The remaining returns finish the pending operations.
+  if (acc) {
+    for (auto bb : func.blocks) {
+      auto term = bb->Terminator();
+      if (term->op != Op::RETURN) continue;
+      auto result = module.NewBinary(op, acc, term->operands[0]);
+      bb->InsertBeforeTerminator(result);
+      term->operands[0] = result;
+    }
+  }
+  RemoveUnreachableBlocks(func);
+  return true;
+}
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <climits>
+#include "passes.h"
+
+using namespace std;
+
+// Fully unrolled loops may run at most this many iterations, and grow to at
+// most this many instructions.
+static const int kMaxFullUnrollTrips = 32;
+static const int kFullUnrollBudget = 256;
+// Partially unrolled bodies are copied this many times, or half as many if
+// that stays within the budget, which counts the instructions of the copies.
+static const int kUnrollFactor = 4;
+static const int kPartialUnrollBudget = 64;
+
+namespace {
+
+// A loop made of one block, body, that branches back to itself while cond
+// holds and otherwise leaves for exit. cond compares next = iv + step with the
+// loop-invariant bound.
+struct CountedLoop {
+  BasicBlock *body, *preheader, *exit;
+  Value *iv, *next, *cond, *bound;
+  int step;
+  bool iv_on_left;  // cond is next op bound rather than bound op next
+};
+
+}  // namespace
+
+static bool MatchCountedLoop(Loop &loop, CountedLoop &info) {
+  if (loop.blocks.size() != 1) return false;
+  auto body = loop.header;
+  auto term = body->Terminator();
+  info.body = body;
+  info.preheader = loop.Preheader();
+  if (!info.preheader || term->op != Op::BRANCH || term->blocks[0] != body || term->blocks[1] == body) return false;
+  info.exit = term->blocks[1];
+  info.cond = term->operands[0];
+  if (info.cond->op != Op::BINARY || info.cond->parent != body) return false;
+  for (auto phi : body->insts) {
+    if (phi->op != Op::PHI) break;
+    auto next = PhiIncoming(phi, body);
+    if (!next || next->op != Op::BINARY || next->binop != BinOp::ADD) continue;
+    auto lhs = next->operands[0], rhs = next->operands[1];
+    if (lhs->IsConst()) swap(lhs, rhs);
+    if (lhs != phi || !rhs->IsConst()) continue;
+    for (int side = 0; side < 2; ++side) {
+      if (info.cond->operands[side] != next || loop.Contains(info.cond->operands[1 - side])) continue;
+      info.iv = phi;
+      info.next = next;
+      info.step = rhs->imm;
+      info.bound = info.cond->operands[1 - side];
+      info.iv_on_left = side == 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The number of times the body runs, if the start value and the bound are
+// constants and it runs at most kMaxFullUnrollTrips times; 0 otherwise.
+static int TripCount(const CountedLoop &info) {
+  auto init = PhiIncoming(info.iv, info.preheader);
+  if (!init->IsConst() || !info.bound->IsConst()) return 0;
+  int value = init->imm;
+  for (int trips = 1; trips <= kMaxFullUnrollTrips; ++trips) {
+    int next = (int)((unsigned)value + (unsigned)info.step), taken;
+    int lhs = info.iv_on_left ? next : info.bound->imm, rhs = info.iv_on_left ? info.bound->imm : next;
+    if (!EvalBinary(info.cond->binop, lhs, rhs, &taken)) return 0;
+    if (!taken) return trips;
+    value = next;
+  }
+  return 0;
+}
+
+static int BodySize(BasicBlock *body) {
+  int size = 0;
+  for (auto inst : body->insts) size += inst->op != Op::PHI && !inst->IsTerminator();
+  return size;
+}
+
+// Appends to bb a copy of the non-phi instructions of body, with operands
+// looked up in values, which also receives the copies. Then updates values so
+// that the phis of body map to their incoming values for the next iteration.
+static void CopyIteration(Module &module, BasicBlock *body, BasicBlock *bb,
+                          unordered_map<Value *, Value *> &values, vector<Value *> &phis) {
+  for (auto inst : body->insts) {
+    if (inst->op == Op::PHI || inst->IsTerminator()) continue;
+    auto copy = module.NewValue(inst->op, inst->ty);
+    *copy = *inst;
+    copy->parent = bb;
+    for (auto &operand : copy->operands) {
+      auto it = values.find(operand);
+      if (it != values.end()) operand = it->second;
+    }
+    bb->insts.push_back(copy);
+    values[inst] = copy;
+  }
+  vector<Value *> incoming;
+  for (auto phi : phis) {
+    auto next = PhiIncoming(phi, body);
+    auto it = values.find(next);
+    incoming.push_back(it != values.end() ? it->second : next);
+  }
+  for (size_t i = 0; i < phis.size(); ++i) values[phis[i]] = incoming[i];
+}
+
+static vector<Value *> Phis(BasicBlock *bb) {
+  vector<Value *> phis;
+  for (auto inst : bb->insts) {
+    if (inst->op != Op::PHI) break;
+    phis.push_back(inst);
+  }
+  return phis;
+}
+
+// Replaces the loop by trips straight-line copies of its body.
+static void FullyUnroll(Module &module, Function &func, const CountedLoop &info, int trips) {
+  auto body = info.body;
+  auto phis = Phis(body);
+  unordered_map<Value *, Value *> values, last;
+  for (auto phi : phis) values[phi] = PhiIncoming(phi, info.preheader);
+  auto insts = body->insts;
+  auto unrolled = module.NewBlock(&func, body->name);
+  for (int i = 0; i < trips; ++i) {
+    last = values;
+    CopyIteration(module, body, unrolled, values, phis);
+    // Keep the values of the final iteration for the code after the loop.
+    if (i == trips - 1) {
+      for (auto inst : body->insts) {
+        if (inst->op != Op::PHI && !inst->IsTerminator()) last[inst] = values[inst];
+      }
+    }
+  }
+  body->insts.swap(unrolled->insts);
+  for (auto inst : body->insts) inst->parent = body;
+  auto jump = module.NewJump(info.exit);
+  jump->parent = body;
+  body->insts.push_back(jump);
+  unordered_map<Value *, Value *> replace;
+  for (auto inst : insts) {
+    if (!inst->IsTerminator()) replace[inst] = last[inst];
+  }
+  ReplaceUses(func, replace);
+}
+
+// Runs factor copies of the body per trip of a new loop while at least that
+// many iterations remain, then finishes in the original loop:
+//
+//   preheader: br iv < bound && bound - iv >= factor, main, body
+//   main:      factor copies; br bound - iv' >= factor, main, check
+//   check:     br iv' < bound, body, exit'
+//   body:      the original loop, exiting to exit'
+//   exit':     phis merging the values of both loops; jump exit
+//
+// The difference bound - iv is positive while iv < bound and does not wrap
+// past the first check, which treats a wrapped difference as too small.
+static void PartiallyUnroll(Module &module, Function &func, const CountedLoop &info, int factor) {
+  auto body = info.body, preheader = info.preheader;
+  auto phis = Phis(body);
+  // Values of the loop used after it, by the instructions using them.
+  vector<Value *> live_out;
+  unordered_set<Value *> seen;
+  for (auto bb : func.blocks) {
+    if (bb == body) continue;
+    for (auto inst : bb->insts) {
+      for (auto operand : inst->operands) {
+        if (operand->parent == body && seen.insert(operand).second) live_out.push_back(operand);
+      }
+    }
+  }
+
+  auto main = module.NewBlock(&func, body->name + "_unrolled");
+  auto check = module.NewBlock(&func, body->name + "_check");
+  auto exit = module.NewBlock(&func, body->name + "_exit");
+  auto add = [&](BasicBlock *bb, Value *inst) {
+    inst->parent = bb;
+    bb->insts.push_back(inst);
+    return inst;
+  };
+  auto at_least_factor = [&](BasicBlock *bb, Value *iv) {
+    auto remaining = add(bb, module.NewBinary(BinOp::SUB, info.bound, iv));
+    return add(bb, module.NewBinary(BinOp::GT, remaining, module.Const(factor - 1)));
+  };
+
+  auto init = PhiIncoming(info.iv, preheader);
+  preheader->insts.pop_back();
+  auto entered = add(preheader, module.NewBinary(BinOp::LT, init, info.bound));
+  auto enough = at_least_factor(preheader, init);
+  auto both = add(preheader, module.NewBinary(BinOp::AND, entered, enough));
+  add(preheader, module.NewBranch(both, main, body));
+
+  unordered_map<Value *, Value *> values;
+  vector<Value *> main_phis;
+  for (auto phi : phis) {
+    auto main_phi = add(main, module.NewPhi(phi->ty));
+    main_phi->operands.push_back(PhiIncoming(phi, preheader));
+    main_phi->blocks.push_back(preheader);
+    main_phis.push_back(main_phi);
+    values[phi] = main_phi;
+  }
+  unordered_map<Value *, Value *> last;
+  for (int i = 0; i < factor; ++i) {
+    last = values;
+    CopyIteration(module, body, main, values, phis);
+  }
+  for (auto inst : body->insts) {
+    if (inst->op != Op::PHI && !inst->IsTerminator()) last[inst] = values[inst];
+  }
+  auto iv = values[info.iv];
+  add(main, module.NewBranch(at_least_factor(main, iv), main, check));
+  for (size_t i = 0; i < phis.size(); ++i) {
+    main_phis[i]->operands.push_back(values[phis[i]]);
+    main_phis[i]->blocks.push_back(main);
+  }
+
+  auto more = add(check, module.NewBinary(BinOp::LT, iv, info.bound));
+  add(check, module.NewBranch(more, body, exit));
+  for (auto phi : phis) {
+    phi->operands.push_back(values[phi]);
+    phi->blocks.push_back(check);
+  }
+  body->Terminator()->blocks[1] = exit;
+
+  unordered_map<Value *, Value *> merged;
+  for (auto value : live_out) {
+    auto phi = add(exit, module.NewPhi(value->ty));
+    phi->operands = {value, last[value]};
+    phi->blocks = {body, check};
+    merged[value] = phi;
+  }
+  add(exit, module.NewJump(info.exit));
+  for (auto bb : func.blocks) {
+    if (bb == body) continue;
+    for (auto inst : bb->insts) {
+      for (auto &operand : inst->operands) {
+        auto it = merged.find(operand);
+        if (it != merged.end()) operand = it->second;
+      }
+      if (inst->op == Op::PHI && bb == info.exit) replace(inst->blocks.begin(), inst->blocks.end(), body, exit);
+    }
+  }
+  func.blocks.push_back(main);
+  func.blocks.push_back(check);
+  func.blocks.push_back(exit);
+}
+
+bool UnrollLoops(Module &module, Function &func) {
+  InsertPreheaders(module, func);
+  DominatorTree dom(func);
+  LoopInfo loops(func, dom);
+  bool changed = false;
+  for (auto loop : loops.Loops()) {
+    CountedLoop info;
+    if (!MatchCountedLoop(*loop, info)) continue;
+    int size = BodySize(info.body);
+    int trips = TripCount(info);
+    if (trips && trips * size <= kFullUnrollBudget) {
+      FullyUnroll(module, func, info, trips);
+      changed = true;
+      continue;
+    }
+    // The remainder check relies on iv < bound meaning another iteration.
+    bool counts_up = info.step == 1 && ((info.iv_on_left && info.cond->binop == BinOp::LT) ||
+                                        (!info.iv_on_left && info.cond->binop == BinOp::GT));
+    if (!counts_up) continue;
+    int factor = kUnrollFactor;
+    while (factor > 1 && factor * size > kPartialUnrollBudget) factor /= 2;
+    if (factor < 2) continue;
+    PartiallyUnroll(module, func, info, factor);
+    changed = true;
+  }
+  if (changed) BuildCFG(func);
+  return changed;
+}